@@ -26,7 +26,45 @@ SOFTWARE.
 #define SHASH_H
 
 #include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// FrozenSpatialHash::save and load are opt in, define SHASH_FILE_IO before including the header to get them
+#if defined(SHASH_FILE_IO)
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
 
 namespace shash
 {
@@ -37,16 +75,26 @@ namespace shash
 
     namespace hashing
     {
+        // every hash function provides hash(x, y, salt, round) on the typed key, hash(void *) hashes the same key
+        // from a buffer of four uint32_t for function pointer use
+        template <typename HashFunction>
+        inline HashValue hash_buffer(const void *buf)
+        {
+            uint32_t key[4];
+            std::memcpy(key, buf, sizeof(key));
+            return HashFunction::hash(key[0], key[1], key[2], key[3]);
+        }
+
         struct Murmur
         {
             static const uint32_t SEED = 15953071;
 
-            inline static uint32_t rotl32(uint32_t x, uint8_t r)
+            constexpr static uint32_t rotl32(uint32_t x, uint8_t r)
             {
                 return (x << r) | (x >> (32 - r));
             }
 
-            inline static uint32_t fmix(uint32_t h)
+            constexpr static uint32_t fmix(uint32_t h)
             {
                 h ^= h >> 16;
                 h *= 0x85ebca6b;
@@ -56,31 +104,139 @@ namespace shash
                 return h;
             }
 
+            constexpr static HashValue hash(uint32_t x, uint32_t y, uint32_t salt, uint32_t round)
+            {
+                uint32_t h1 = SEED;
+                h1 = mix_hash(h1, mix_key(x));
+                h1 = mix_hash(h1, mix_key(y));
+                h1 = mix_hash(h1, mix_key(salt));
+                h1 = mix_hash(h1, mix_key(round));
+                return fmix(h1 ^ 16);
+            }
+
             inline static HashValue hash(void *buf)
             {
-                int length = 4;
-                uint32_t *b = (uint32_t *)buf;
+                return hash_buffer<Murmur>(buf);
+            }
 
-                uint32_t h1 = SEED;
-                uint32_t k1 = 0;
+            constexpr static uint32_t mix_key(uint32_t k1)
+            {
+                k1 *= 0xcc9e2d51;
+                k1 = rotl32(k1, 15);
+                k1 *= 0x1b873593;
+                return k1;
+            }
+
+            constexpr static uint32_t mix_hash(uint32_t h1, uint32_t k1)
+            {
+                h1 ^= k1;
+                h1 = rotl32(h1, 13);
+                return h1 * 5 + 0xe6546b64;
+            }
+
+            // hashes the keys (x + i, y, salt, round) for i in [0, count), same results as hash() on every key
+            inline static void hash_row(uint32_t x, uint32_t y, uint32_t salt, uint32_t round, HashValue *hashes, size_t count)
+            {
+                const uint32_t k_y = mix_key(y);
+                const uint32_t k_salt = mix_key(salt);
+                const uint32_t k_round = mix_key(round);
+                size_t i = 0;
 
-                for (int i = 0; i < length; i++)
+#if defined(__AVX512F__)
+                const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+                for (; i + 16 <= count; i += 16)
                 {
-                    k1 = (uint32_t)b[i];
+                    __m512i k = _mm512_add_epi32(_mm512_set1_epi32(x + i), lanes);
+                    k = _mm512_mullo_epi32(k, _mm512_set1_epi32(0xcc9e2d51));
+                    k = _mm512_rol_epi32(k, 15);
+                    k = _mm512_mullo_epi32(k, _mm512_set1_epi32(0x1b873593));
 
-                    k1 *= 0xcc9e2d51;
-                    k1 = rotl32(k1, 15);
-                    k1 *= 0x1b873593;
+                    __m512i h = _mm512_xor_si512(_mm512_set1_epi32(SEED), k);
+                    for (uint32_t word : {0u, k_y, k_salt, k_round})
+                    {
+                        h = _mm512_xor_si512(h, _mm512_set1_epi32(word));
+                        h = _mm512_rol_epi32(h, 13);
+                        h = _mm512_add_epi32(_mm512_mullo_epi32(h, _mm512_set1_epi32(5)), _mm512_set1_epi32(0xe6546b64));
+                    }
 
-                    h1 ^= k1;
-                    h1 = rotl32(h1, 13);
-                    h1 = h1 * 5 + 0xe6546b64;
+                    h = _mm512_xor_si512(h, _mm512_set1_epi32(16));
+                    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+                    h = _mm512_mullo_epi32(h, _mm512_set1_epi32(0x85ebca6b));
+                    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+                    h = _mm512_mullo_epi32(h, _mm512_set1_epi32(0xc2b2ae35));
+                    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+
+                    _mm512_storeu_si512((void *)(hashes + i), h);
+                }
+#endif
+
+#if defined(__AVX2__)
+                const __m256i lanes8 = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+                for (; i + 8 <= count; i += 8)
+                {
+                    __m256i k = _mm256_add_epi32(_mm256_set1_epi32(x + i), lanes8);
+                    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(0xcc9e2d51));
+                    k = _mm256_or_si256(_mm256_slli_epi32(k, 15), _mm256_srli_epi32(k, 17));
+                    k = _mm256_mullo_epi32(k, _mm256_set1_epi32(0x1b873593));
+
+                    __m256i h = _mm256_xor_si256(_mm256_set1_epi32(SEED), k);
+                    for (uint32_t word : {0u, k_y, k_salt, k_round})
+                    {
+                        h = _mm256_xor_si256(h, _mm256_set1_epi32(word));
+                        h = _mm256_or_si256(_mm256_slli_epi32(h, 13), _mm256_srli_epi32(h, 19));
+                        h = _mm256_add_epi32(_mm256_mullo_epi32(h, _mm256_set1_epi32(5)), _mm256_set1_epi32(0xe6546b64));
+                    }
+
+                    h = _mm256_xor_si256(h, _mm256_set1_epi32(16));
+                    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+                    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x85ebca6b));
+                    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+                    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0xc2b2ae35));
+                    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+
+                    _mm256_storeu_si256((__m256i *)(hashes + i), h);
                 }
+#endif
+
+#if defined(__ARM_NEON)
+                const uint32_t lane_offsets[4] = {0, 1, 2, 3};
+                const uint32x4_t lanes4 = vld1q_u32(lane_offsets);
+                for (; i + 4 <= count; i += 4)
+                {
+                    uint32x4_t k = vaddq_u32(vdupq_n_u32(x + i), lanes4);
+                    k = vmulq_n_u32(k, 0xcc9e2d51);
+                    k = vorrq_u32(vshlq_n_u32(k, 15), vshrq_n_u32(k, 17));
+                    k = vmulq_n_u32(k, 0x1b873593);
 
-                h1 ^= (uint32_t)(length * 4);
-                h1 = fmix(h1);
+                    uint32x4_t h = veorq_u32(vdupq_n_u32(SEED), k);
+                    for (uint32_t word : {0u, k_y, k_salt, k_round})
+                    {
+                        h = veorq_u32(h, vdupq_n_u32(word));
+                        h = vorrq_u32(vshlq_n_u32(h, 13), vshrq_n_u32(h, 19));
+                        h = vaddq_u32(vmulq_n_u32(h, 5), vdupq_n_u32(0xe6546b64));
+                    }
+
+                    h = veorq_u32(h, vdupq_n_u32(16));
+                    h = veorq_u32(h, vshrq_n_u32(h, 16));
+                    h = vmulq_n_u32(h, 0x85ebca6b);
+                    h = veorq_u32(h, vshrq_n_u32(h, 13));
+                    h = vmulq_n_u32(h, 0xc2b2ae35);
+                    h = veorq_u32(h, vshrq_n_u32(h, 16));
+
+                    vst1q_u32(hashes + i, h);
+                }
+#endif
 
-                return h1;
+                for (; i < count; i++)
+                {
+                    uint32_t h1 = SEED ^ mix_key(x + i);
+                    h1 = rotl32(h1, 13);
+                    h1 = h1 * 5 + 0xe6546b64;
+                    h1 = mix_hash(h1, k_y);
+                    h1 = mix_hash(h1, k_salt);
+                    h1 = mix_hash(h1, k_round);
+                    hashes[i] = fmix(h1 ^ 16);
+                }
             }
         };
 
@@ -93,12 +249,12 @@ namespace shash
             static const uint32_t PRIME32_5 = 374761393U;
             static const uint32_t SEED = 15953071;
 
-            inline static uint32_t rotate_left(uint32_t value, int count)
+            constexpr static uint32_t rotate_left(uint32_t value, int count)
             {
                 return (value << count) | (value >> (32 - count));
             }
 
-            inline static uint32_t sub_hash(uint32_t value, uint32_t read_value)
+            constexpr static uint32_t sub_hash(uint32_t value, uint32_t read_value)
             {
                 value += read_value * PRIME32_2;
                 value = rotate_left(value, 13);
@@ -106,49 +262,13 @@ namespace shash
                 return value;
             }
 
-            inline static HashValue hash(void *buf)
+            constexpr static HashValue hash(uint32_t x, uint32_t y, uint32_t salt, uint32_t round)
             {
-                uint32_t *b = (uint32_t *)buf;
-                int len = 4;
-
-                uint32_t h32;
-                int index = 0;
-
-                if (len >= 4)
-                {
-                    int limit = len - 4;
-                    uint32_t v1 = SEED + PRIME32_1 + PRIME32_2;
-                    uint32_t v2 = SEED + PRIME32_2;
-                    uint32_t v3 = SEED + 0;
-                    uint32_t v4 = SEED - PRIME32_1;
-
-                    do
-                    {
-                        v1 = sub_hash(v1, b[index]);
-                        index++;
-                        v2 = sub_hash(v2, b[index]);
-                        index++;
-                        v3 = sub_hash(v3, b[index]);
-                        index++;
-                        v4 = sub_hash(v4, b[index]);
-                        index++;
-                    } while (index <= limit);
-
-                    h32 = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
-                }
-                else
-                {
-                    h32 = SEED + PRIME32_5;
-                }
-
-                h32 += (uint32_t)len * 4;
-
-                while (index < len)
-                {
-                    h32 += b[index] * PRIME32_3;
-                    h32 = rotate_left(h32, 17) * PRIME32_4;
-                    index++;
-                }
+                // a single 16 byte stripe
+                uint32_t h32 = rotate_left(sub_hash(SEED + PRIME32_1 + PRIME32_2, x), 1) +
+                               rotate_left(sub_hash(SEED + PRIME32_2, y), 7) +
+                               rotate_left(sub_hash(SEED + 0, salt), 12) +
+                               rotate_left(sub_hash(SEED - PRIME32_1, round), 18) + 16;
 
                 h32 ^= h32 >> 15;
                 h32 *= PRIME32_2;
@@ -158,28 +278,79 @@ namespace shash
 
                 return h32;
             }
+
+            inline static HashValue hash(void *buf)
+            {
+                return hash_buffer<xxHash>(buf);
+            }
+
+            // hashes the keys (x + i, y, salt, round) for i in [0, count), written to be auto-vectorized
+            inline static void hash_row(uint32_t x, uint32_t y, uint32_t salt, uint32_t round, HashValue *hashes, size_t count)
+            {
+                const uint32_t rest = rotate_left(sub_hash(SEED + PRIME32_2, y), 7) +
+                                      rotate_left(sub_hash(SEED + 0, salt), 12) +
+                                      rotate_left(sub_hash(SEED - PRIME32_1, round), 18) + 16;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    uint32_t h32 = rotate_left(sub_hash(SEED + PRIME32_1 + PRIME32_2, x + (uint32_t)i), 1) + rest;
+                    h32 ^= h32 >> 15;
+                    h32 *= PRIME32_2;
+                    h32 ^= h32 >> 13;
+                    h32 *= PRIME32_3;
+                    h32 ^= h32 >> 16;
+                    hashes[i] = h32;
+                }
+            }
         };
 
         struct Custom
         {
-            inline static HashValue hash(void *buf)
+            constexpr static HashValue hash(uint32_t x, uint32_t y, uint32_t salt, uint32_t round)
             {
                 const uint32_t _p1 = 15953071;
                 const uint32_t _p2 = 37953119;
                 const uint32_t _p3 = 73856093;
                 const uint32_t _p4 = 93856897;
-                uint32_t *b = (uint32_t *)buf;
-                return ((_p1 * *(b + 0)) ^ (_p2 * *(b + 1)) ^ (_p3 * *(b + 2)) ^ (_p4 * *(b + 3)));
+                return ((_p1 * x) ^ (_p2 * y) ^ (_p3 * salt) ^ (_p4 * round));
+            }
+
+            inline static HashValue hash(void *buf)
+            {
+                return hash_buffer<Custom>(buf);
+            }
+
+            inline static void hash_row(uint32_t x, uint32_t y, uint32_t salt, uint32_t round, HashValue *hashes, size_t count)
+            {
+                const uint32_t rest = (37953119 * y) ^ (73856093 * salt) ^ (93856897 * round);
+
+                for (size_t i = 0; i < count; i++)
+                    hashes[i] = (15953071 * (x + (uint32_t)i)) ^ rest;
             }
         };
 
         struct Knuth
         {
-            inline static HashValue hash(void *buf)
+            constexpr static HashValue hash(uint32_t x, uint32_t y, uint32_t salt, uint32_t round)
             {
-                uint64_t *b = (uint64_t *)buf;
+                // the key as two 64 bit words, the way the 16 byte buffer used to be read on little endian
+                uint64_t low = (uint64_t)y << 32 | x;
+                uint64_t high = (uint64_t)round << 32 | salt;
                 // bitshift (middle bits contain more entropy) 8 instead of 16 to preserve lower bits for later range reduction
-                return ((b[0] ^ b[1]) * 2654435761 >> 8);
+                return ((low ^ high) * 2654435761 >> 8);
+            }
+
+            inline static HashValue hash(void *buf)
+            {
+                return hash_buffer<Knuth>(buf);
+            }
+
+            inline static void hash_row(uint32_t x, uint32_t y, uint32_t salt, uint32_t round, HashValue *hashes, size_t count)
+            {
+                const uint64_t rest = ((uint64_t)y << 32) ^ ((uint64_t)round << 32 | salt);
+
+                for (size_t i = 0; i < count; i++)
+                    hashes[i] = ((rest ^ (x + (uint32_t)i)) * 2654435761 >> 8);
             }
         };
 
@@ -214,345 +385,6167 @@ namespace shash
 
     } // namespace reduction
 
-    using real = double;
-
-    template <typename Value, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5>
-    class SpatialHash
+    namespace detail
     {
-    public:
-        struct HashBucket
+
+        template <typename HashFunction, typename = void>
+        struct has_hash_row : std::false_type
         {
-            int x;
-            int y;
-            unsigned int last_claimed = -1;
-            std::vector<Value> data;
         };
 
-        SpatialHash();
-
-        SpatialHash(
-            real cell_size,
-            unsigned int table_size);
-
-        void reset(real cell_size, unsigned int table_size);
+        template <typename HashFunction>
+        struct has_hash_row<HashFunction, std::void_t<decltype(HashFunction::hash_row(0u, 0u, 0u, 0u, (HashValue *)nullptr, (size_t)0))>>
+            : std::true_type
+        {
+        };
 
-        void insert_at_cell(
-            int x,
-            int y,
-            Value &value,
-            int salt = 0);
+        // visitors may return void (never stop) or bool (false stops the walk)
+        template <typename Visitor, typename... Args>
+        inline bool visit(Visitor &visitor, Args &&...args)
+        {
+            if constexpr (std::is_void_v<std::invoke_result_t<Visitor &, Args &&...>>)
+            {
+                visitor(std::forward<Args>(args)...);
+                return true;
+            }
+            else
+            {
+                return visitor(std::forward<Args>(args)...);
+            }
+        }
 
-        void insert_at_point(
-            real x,
-            real y,
-            Value &value,
-            int salt = 0);
+        // splits [0, count) into one contiguous range per thread, function(thread, begin, end) runs once per range
+        template <typename Function>
+        inline void parallel_for(unsigned int threads, size_t count, Function &&function)
+        {
+            std::vector<std::thread> workers;
+            workers.reserve(threads - 1);
 
-        void insert_at_aabb(
-            real top_left_x,
-            real top_left_y,
-            real bottom_right_x,
-            real bottom_right_y,
-            Value &value,
-            int salt = 0);
+            for (unsigned int thread = 1; thread < threads; thread++)
+            {
+                workers.emplace_back([&function, thread, threads, count]() {
+                    function(thread, count * thread / threads, count * (thread + 1) / threads);
+                });
+            }
 
-        void insert_at_segment(
-            real start_x_coord,
-            real start_y_coord,
-            real end_x_coord,
-            real end_y_coord,
-            Value &value,
-            int salt = 0);
+            function(0, 0, count / threads);
 
-        void query_at_cell(
-            std::vector<Value> &result,
-            int x,
-            int y,
-            int salt = 0);
+            for (auto &worker : workers)
+                worker.join();
+        }
 
-        void query_at_point(
-            std::vector<Value> &result,
-            real x,
-            real y,
-            int salt = 0);
+        // hint that address is read soon, lookups of a batch overlap their cache misses this way
+        inline void prefetch(const void *address)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(address);
+#else
+            (void)address;
+#endif
+        }
 
-        void query_at_aabb(
-            std::vector<Value> &result,
-            real top_left_x,
-            real top_left_y,
-            real bottom_right_x,
-            real bottom_right_y,
-            int salt = 0);
+        // double hashing, probe round of a key lands on hash + round * step with an odd step taken from the rotated
+        // hash, so only the first probe needs the full hash function
+        inline HashValue probe_hash(HashValue hash, size_t round)
+        {
+            HashValue step = ((hash >> 16 | hash << 16) * 0x9e3779b9u) | 1u;
+            return hash + (HashValue)round * step;
+        }
 
-        void query_at_segment(
-            std::vector<Value> &result,
-            real start_x_coord,
-            real start_y_coord,
-            real end_x_coord,
-            real end_y_coord,
-            int salt = 0);
+        // calls cell_visitor(x, y) for every cell of the inclusive rectangle, stops as soon as it returns false
+        template <typename CellVisitor>
+        inline bool for_each_cell_in_aabb(int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, CellVisitor &&cell_visitor)
+        {
+            for (int i = top_left_x; i <= bottom_right_x; i++)
+            {
+                for (int j = top_left_y; j <= bottom_right_y; j++)
+                {
+                    if (!cell_visitor(i, j))
+                        return false;
+                }
+            }
 
-        //private:
-        int cell(real coordinate) const;
-        HashBucket *get_bucket(int x, int y, int salt);
+            return true;
+        }
 
-    private:
-        real _inv_cell_size;
-        unsigned int _table_size;
-        unsigned int _current_round = 0; // pepper
+        // squared distance from the point to the nearest point of cell (x, y), coordinates in cell units
+        inline double cell_distance_squared(double point_x, double point_y, int x, int y)
+        {
+            double dx = std::max(std::max(x - point_x, point_x - (x + 1)), 0.0);
+            double dy = std::max(std::max(y - point_y, point_y - (y + 1)), 0.0);
+            return dx * dx + dy * dy;
+        }
 
-        std::vector<HashBucket> _hash_table;
-    };
+        // calls row_visitor(first_x, last_x, y) with the inclusive run of cells of every row that intersects the disc,
+        // coordinates in cell units, stops as soon as it returns false
+        template <typename RowVisitor>
+        inline bool for_each_row_in_disc(double center_x, double center_y, double radius, RowVisitor &&row_visitor)
+        {
+            if (radius < 0.0)
+                return true;
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::SpatialHash()
-        : _inv_cell_size(1.0 / 1.0),
-          _table_size(1024)
-    {
-        _hash_table.resize(_table_size, HashBucket());
-    }
+            int first_y = std::floor(center_y - radius);
+            int last_y = std::floor(center_y + radius);
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::SpatialHash(
-        real cell_size,
-        unsigned int table_size)
-        : _inv_cell_size(1.0 / cell_size),
-          _table_size(table_size)
-    {
-        _hash_table.resize(_table_size, HashBucket());
-    }
+            for (int y = first_y; y <= last_y; y++)
+            {
+                double dy = center_y - std::min(std::max(center_y, (double)y), (double)(y + 1));
+                double half_width = std::sqrt(std::max(radius * radius - dy * dy, 0.0));
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::reset(real cell_size, unsigned int table_size)
-    {
-        _inv_cell_size = 1.0 / cell_size;
-        _current_round += 1;
+                if (!row_visitor((int)std::floor(center_x - half_width), (int)std::floor(center_x + half_width), y))
+                    return false;
+            }
 
-        if (_table_size != table_size)
-        {
-            _table_size = table_size;
-            _hash_table.resize(_table_size, HashBucket());
+            return true;
         }
-    }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::insert_at_cell(
-        int x,
-        int y,
-        Value &value,
-        int salt)
-    {
-        HashBucket *bucket = get_bucket(x, y, salt);
-        bucket->data.push_back(value);
-    }
+        // calls cell_visitor(x, y) for every cell at chebyshev distance ring from cell (x0, y0)
+        template <typename CellVisitor>
+        inline bool for_each_cell_on_ring(int x0, int y0, int ring, CellVisitor &&cell_visitor)
+        {
+            if (ring == 0)
+                return cell_visitor(x0, y0);
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::insert_at_point(
-        real x,
-        real y,
-        Value &value,
-        int salt)
-    {
-        int cell_x = cell(x);
-        int cell_y = cell(y);
+            for (int x = x0 - ring; x <= x0 + ring; x++)
+            {
+                if (!cell_visitor(x, y0 - ring) || !cell_visitor(x, y0 + ring))
+                    return false;
+            }
 
-        insert_at_cell(cell_x, cell_y, value, salt);
-    }
+            for (int y = y0 - ring + 1; y <= y0 + ring - 1; y++)
+            {
+                if (!cell_visitor(x0 - ring, y) || !cell_visitor(x0 + ring, y))
+                    return false;
+            }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::insert_at_aabb(
-        real top_left_x,
-        real top_left_y,
-        real bottom_right_x,
-        real bottom_right_y,
-        Value &value,
-        int salt)
-    {
-        int top_left_x_cell = cell(top_left_x);
-        int top_left_y_cell = cell(top_left_y);
-        int bottom_right_x_cell = cell(bottom_right_x);
-        int bottom_right_y_cell = cell(bottom_right_y);
+            return true;
+        }
 
-        for (int i = top_left_x_cell; i <= bottom_right_x_cell; i++)
+        // like for_each_cell_on_ring, but only the cells of the ring inside the inclusive rectangle are visited
+        template <typename CellVisitor>
+        inline bool for_each_cell_on_ring_in_aabb(int x0, int y0, int ring, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, CellVisitor &&cell_visitor)
         {
-            for (int j = top_left_y_cell; j <= bottom_right_y_cell; j++)
+            int first_x = std::max(x0 - ring, top_left_x);
+            int last_x = std::min(x0 + ring, bottom_right_x);
+
+            for (int y : {y0 - ring, y0 + ring})
             {
-                insert_at_cell(i, j, value, salt);
+                if (y >= top_left_y && y <= bottom_right_y)
+                {
+                    for (int x = first_x; x <= last_x; x++)
+                    {
+                        if (!cell_visitor(x, y))
+                            return false;
+                    }
+                }
+
+                if (ring == 0)
+                    return true;
             }
-        }
-    }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::insert_at_segment(
-        real start_x_coord,
-        real start_y_coord,
-        real end_x_coord,
-        real end_y_coord,
-        Value &value,
-        int salt)
-    {
-        int x0 = cell(start_x_coord);
-        int y0 = cell(start_y_coord);
-        int x1 = cell(end_x_coord);
-        int y1 = cell(end_y_coord);
+            int first_y = std::max(y0 - ring + 1, top_left_y);
+            int last_y = std::min(y0 + ring - 1, bottom_right_y);
 
-        int dx = std::abs(x1 - x0);
-        int dy = -std::abs(y1 - y0);
-        int sx = x0 < x1 ? 1 : -1;
-        int sy = y0 < y1 ? 1 : -1;
-        int err = dx + dy;
-        int e2;
+            for (int x : {x0 - ring, x0 + ring})
+            {
+                if (x < top_left_x || x > bottom_right_x)
+                    continue;
 
-        while (true)
+                for (int y = first_y; y <= last_y; y++)
+                {
+                    if (!cell_visitor(x, y))
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        // calls cell_visitor(x, y, t_enter, t_exit) for every cell crossed by origin + t * direction, t in [0, max_t]
+        template <typename CellVisitor>
+        inline bool for_each_cell_on_ray(double origin_x, double origin_y, double direction_x, double direction_y, double max_t, CellVisitor &&cell_visitor)
         {
-            insert_at_cell(x0, y0, value, salt);
+            const double infinity = std::numeric_limits<double>::infinity();
 
-            if (x0 == x1 && y0 == y1)
-                break;
+            int x = std::floor(origin_x);
+            int y = std::floor(origin_y);
+            int step_x = direction_x < 0.0 ? -1 : 1;
+            int step_y = direction_y < 0.0 ? -1 : 1;
 
-            e2 = 2 * err;
+            // ray parameter at which the next vertical / horizontal cell border is crossed, and between two of them
+            double delta_x = direction_x != 0.0 ? std::abs(1.0 / direction_x) : infinity;
+            double delta_y = direction_y != 0.0 ? std::abs(1.0 / direction_y) : infinity;
+            double next_x = direction_x != 0.0 ? ((step_x > 0 ? x + 1 : x) - origin_x) / direction_x : infinity;
+            double next_y = direction_y != 0.0 ? ((step_y > 0 ? y + 1 : y) - origin_y) / direction_y : infinity;
 
-            if (e2 > dy)
-            {
-                err += dy;
-                x0 += sx;
-            }
-            else if (e2 < dx)
+            double t_enter = 0.0;
+
+            while (true)
             {
-                err += dx;
-                y0 += sy;
-            }
-        }
+                double t_exit = std::min(std::min(next_x, next_y), max_t);
+
+                if (!cell_visitor(x, y, t_enter, t_exit))
+                    return false;
+
+                // the end point still belongs to the last cell even if it lies on its border
+                if (std::min(next_x, next_y) > max_t)
+                    break;
+
+                t_enter = t_exit;
+
+                // passing exactly through a corner steps diagonally, the side cells are only touched in a point
+                bool cross_x = next_x <= next_y;
+                bool cross_y = next_y <= next_x;
+
+                if (cross_x)
+                {
+                    x += step_x;
+                    next_x += delta_x;
+                }
+
+                if (cross_y)
+                {
+                    y += step_y;
+                    next_y += delta_y;
+                }
+            }
+
+            return true;
+        }
+
+        // key of an n dimensional cell, 2d cells hash like the ones of the plane
+        template <typename HashFunction, size_t DIMENSIONS>
+        inline HashValue hash_cell(const std::array<int, DIMENSIONS> &cell, uint32_t salt, uint32_t round)
+        {
+            if constexpr (DIMENSIONS == 2)
+            {
+                return HashFunction::hash(cell[0], cell[1], salt, round);
+            }
+            else
+            {
+                // odd factor, distinct salts of one round keep distinct words
+                uint32_t tag = salt * 0x9e3779b9u + round;
+                HashValue hash = HashFunction::hash(cell[0], cell[1], cell[2], tag);
+
+                for (size_t i = 3; i < DIMENSIONS; i += 3)
+                {
+                    uint32_t y = i + 1 < DIMENSIONS ? cell[i + 1] : 0;
+                    uint32_t z = i + 2 < DIMENSIONS ? cell[i + 2] : 0;
+                    hash = HashFunction::hash(cell[i], y, z, hash);
+                }
+
+                return hash;
+            }
+        }
+
+        // calls cell_visitor(cell) for every cell of the inclusive box, the first axis varies slowest
+        template <size_t DIMENSIONS, typename CellVisitor>
+        inline bool for_each_cell_in_box(const std::array<int, DIMENSIONS> &min_cell, const std::array<int, DIMENSIONS> &max_cell, CellVisitor &&cell_visitor)
+        {
+            for (size_t axis = 0; axis < DIMENSIONS; axis++)
+            {
+                if (min_cell[axis] > max_cell[axis])
+                    return true;
+            }
+
+            std::array<int, DIMENSIONS> cell = min_cell;
+
+            while (true)
+            {
+                if (!cell_visitor(cell))
+                    return false;
+
+                size_t axis = DIMENSIONS;
+                while (axis > 0 && cell[axis - 1] == max_cell[axis - 1])
+                {
+                    cell[axis - 1] = min_cell[axis - 1];
+                    axis--;
+                }
+
+                if (axis == 0)
+                    return true;
+
+                cell[axis - 1] += 1;
+            }
+        }
+
+        // for_each_cell_on_ray in n dimensions, cell_visitor(cell, t_enter, t_exit)
+        template <size_t DIMENSIONS, typename CellVisitor>
+        inline bool for_each_cell_on_ray(const std::array<double, DIMENSIONS> &origin, const std::array<double, DIMENSIONS> &direction, double max_t, CellVisitor &&cell_visitor)
+        {
+            const double infinity = std::numeric_limits<double>::infinity();
+
+            std::array<int, DIMENSIONS> cell;
+            std::array<int, DIMENSIONS> step;
+            std::array<double, DIMENSIONS> delta;
+            std::array<double, DIMENSIONS> next;
+
+            for (size_t axis = 0; axis < DIMENSIONS; axis++)
+            {
+                cell[axis] = std::floor(origin[axis]);
+                step[axis] = direction[axis] < 0.0 ? -1 : 1;
+                delta[axis] = direction[axis] != 0.0 ? std::abs(1.0 / direction[axis]) : infinity;
+                next[axis] = direction[axis] != 0.0 ? ((step[axis] > 0 ? cell[axis] + 1 : cell[axis]) - origin[axis]) / direction[axis] : infinity;
+            }
+
+            double t_enter = 0.0;
+
+            while (true)
+            {
+                double t_next = *std::min_element(next.begin(), next.end());
+                double t_exit = std::min(t_next, max_t);
+
+                if (!cell_visitor(cell, t_enter, t_exit))
+                    return false;
+
+                if (t_next > max_t)
+                    break;
+
+                t_enter = t_exit;
+
+                // every axis whose border lies exactly at t_next is crossed at once, like a corner in the plane
+                for (size_t axis = 0; axis < DIMENSIONS; axis++)
+                {
+                    if (next[axis] <= t_next)
+                    {
+                        cell[axis] += step[axis];
+                        next[axis] += delta[axis];
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        // interleaved bits of x and y, every cell of a rectangle lies between the codes of its corners
+        inline uint64_t morton_code(int x, int y)
+        {
+            auto spread = [](uint64_t v) {
+                v = (v | v << 16) & 0x0000ffff0000ffffull;
+                v = (v | v << 8) & 0x00ff00ff00ff00ffull;
+                v = (v | v << 4) & 0x0f0f0f0f0f0f0f0full;
+                v = (v | v << 2) & 0x3333333333333333ull;
+                v = (v | v << 1) & 0x5555555555555555ull;
+                return v;
+            };
+
+            return spread((uint32_t)x ^ 0x80000000u) | spread((uint32_t)y ^ 0x80000000u) << 1;
+        }
+
+    } // namespace detail
+
+    template <typename Iterator>
+    struct Range
+    {
+        Iterator first;
+        Iterator last;
+
+        inline Iterator begin() const
+        {
+            return first;
+        }
+
+        inline Iterator end() const
+        {
+            return last;
+        }
+
+        inline bool empty() const
+        {
+            return first == last;
+        }
+    };
+
+    namespace memory
+    {
+        // monotonic memory resource, rewind() hands out the same blocks again in O(1)
+        class RoundArena : public std::pmr::memory_resource
+        {
+        public:
+            explicit RoundArena(std::pmr::memory_resource *upstream = std::pmr::get_default_resource(), size_t block_size = 64 * 1024)
+                : _upstream(upstream),
+                  _block_size(block_size),
+                  _blocks(upstream)
+            {
+            }
+
+            RoundArena(const RoundArena &) = delete;
+            RoundArena &operator=(const RoundArena &) = delete;
+
+            ~RoundArena()
+            {
+                for (Block &block : _blocks)
+                    _upstream->deallocate(block.data, block.size, alignof(std::max_align_t));
+            }
+
+            // everything allocated so far becomes invalid
+            inline void rewind()
+            {
+                _block = 0;
+                _offset = 0;
+            }
+
+            inline size_t capacity() const
+            {
+                size_t bytes = 0;
+                for (const Block &block : _blocks)
+                    bytes += block.size;
+                return bytes;
+            }
+
+        private:
+            struct Block
+            {
+                std::byte *data;
+                size_t size;
+            };
+
+            void *do_allocate(size_t bytes, size_t alignment) override
+            {
+                while (true)
+                {
+                    if (_block < _blocks.size())
+                    {
+                        Block &block = _blocks[_block];
+                        size_t offset = (_offset + alignment - 1) & ~(alignment - 1);
+
+                        if (offset + bytes <= block.size)
+                        {
+                            _offset = offset + bytes;
+                            return block.data + offset;
+                        }
+
+                        _block += 1;
+                        _offset = 0;
+                        continue;
+                    }
+
+                    size_t size = std::max(bytes + alignment, _blocks.empty() ? _block_size : _blocks.back().size * 2);
+                    _blocks.push_back({(std::byte *)_upstream->allocate(size, alignof(std::max_align_t)), size});
+                }
+            }
+
+            void do_deallocate(void *, size_t, size_t) override
+            {
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+            {
+                return this == &other;
+            }
+
+            std::pmr::memory_resource *_upstream;
+            size_t _block_size;
+            std::pmr::vector<Block> _blocks;
+            size_t _block = 0;
+            size_t _offset = 0;
+        };
+
+    } // namespace memory
+
+    namespace storage
+    {
+        // every Store is constructed with the memory resource of its SpatialHash
+
+        // every bucket owns its own std::vector, values of a bucket are contiguous but buckets are spread over the heap
+        struct Vector
+        {
+            template <typename Value>
+            class Store
+            {
+            public:
+                // buckets reserved up front can be filled from different threads at once
+                static const bool INDEPENDENT_BUCKETS = true;
+
+                using Bucket = std::pmr::vector<Value>;
+
+                explicit Store(std::pmr::memory_resource *resource)
+                    : _resource(resource)
+                {
+                }
+
+                inline void reset()
+                {
+                }
+
+                // buckets are created empty by the table, they are bound to the resource the first time they are claimed
+                inline void clear(Bucket &bucket)
+                {
+                    if (bucket.get_allocator().resource() != _resource)
+                    {
+                        bucket.~Bucket();
+                        new (&bucket) Bucket(_resource);
+                    }
+                    else
+                    {
+                        bucket.clear();
+                    }
+                }
+
+                // heap memory held by a bucket, and giving it back once the bucket went stale
+                inline size_t bytes(const Bucket &bucket) const
+                {
+                    return bucket.capacity() * sizeof(Value);
+                }
+
+                inline void trim(Bucket &bucket)
+                {
+                    bucket.clear();
+                    bucket.shrink_to_fit();
+                }
+
+                // memory shared by all buckets
+                inline void shrink_to_fit()
+                {
+                }
+
+                inline void push_back(Bucket &bucket, const Value &value)
+                {
+                    bucket.push_back(value);
+                }
+
+                inline void reserve(Bucket &bucket, size_t additional)
+                {
+                    bucket.reserve(bucket.size() + additional);
+                }
+
+                // removes one occurrence of value, the order of the remaining values is not preserved
+                inline bool erase(Bucket &bucket, const Value &value)
+                {
+                    auto found = std::find(bucket.begin(), bucket.end(), value);
+                    if (found == bucket.end())
+                        return false;
+
+                    *found = bucket.back();
+                    bucket.pop_back();
+                    return true;
+                }
+
+                inline size_t size(const Bucket &bucket) const
+                {
+                    return bucket.size();
+                }
+
+                inline Range<const Value *> range(const Bucket &bucket) const
+                {
+                    return {bucket.data(), bucket.data() + bucket.size()};
+                }
+
+                // calls visitor(first, last) for every contiguous run of values, stops as soon as visitor returns false
+                template <typename Visitor>
+                inline bool for_each_span(const Bucket &bucket, Visitor &&visitor) const
+                {
+                    if (bucket.empty())
+                        return true;
+
+                    return visitor(bucket.data(), bucket.data() + bucket.size());
+                }
+
+            private:
+                std::pmr::memory_resource *_resource;
+            };
+        };
+
+        // like Vector, but bump allocated from a RoundArena that reset rewinds
+        struct Monotonic
+        {
+            template <typename Value>
+            class Store : public Vector::Store<Value>
+            {
+                static_assert(std::is_trivially_destructible<Value>::value, "values are dropped without being destroyed");
+
+            public:
+                static const bool INDEPENDENT_BUCKETS = false;
+
+                using Bucket = typename Vector::Store<Value>::Bucket;
+
+                explicit Store(std::pmr::memory_resource *resource)
+                    : Vector::Store<Value>(&_arena),
+                      _arena(resource)
+                {
+                }
+
+                inline void reset()
+                {
+                    _arena.rewind();
+                }
+
+                inline void clear(Bucket &bucket)
+                {
+                    bucket.~Bucket();
+                    new (&bucket) Bucket(&_arena);
+                }
+
+                // the bucket vectors live in the round arena, which keeps its blocks for the next round
+                inline size_t bytes(const Bucket &) const
+                {
+                    return 0;
+                }
+
+                inline void trim(Bucket &)
+                {
+                }
+
+            private:
+                memory::RoundArena _arena;
+            };
+        };
+
+        // values live in one slab of fixed size chunks, a bucket holds the index of its newest chunk and its length
+        template <size_t CHUNK_SIZE = 8>
+        struct Arena
+        {
+            static_assert(CHUNK_SIZE > 0, "chunks need to hold at least one value");
+
+            template <typename Value>
+            class Store
+            {
+                struct Chunk
+                {
+                    Value values[CHUNK_SIZE];
+                    uint32_t next;
+                };
+
+            public:
+                static const uint32_t NONE = -1;
+                static const bool INDEPENDENT_BUCKETS = false;
+
+                struct Bucket
+                {
+                    uint32_t offset = NONE;
+                    uint32_t length = 0;
+                };
+
+                explicit Store(std::pmr::memory_resource *resource)
+                    : _chunks(resource)
+                {
+                }
+
+                inline void reset()
+                {
+                    _chunks.clear();
+                }
+
+                inline void clear(Bucket &bucket)
+                {
+                    bucket.offset = NONE;
+                    bucket.length = 0;
+                }
+
+                // buckets own no memory, the slab is shared
+                inline size_t bytes(const Bucket &) const
+                {
+                    return 0;
+                }
+
+                inline void trim(Bucket &)
+                {
+                }
+
+                inline void shrink_to_fit()
+                {
+                    _chunks.shrink_to_fit();
+                }
+
+                class const_iterator
+                {
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = Value;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = const Value *;
+                    using reference = const Value &;
+
+                    const_iterator() = default;
+
+                    const_iterator(const Chunk *chunks, uint32_t chunk, size_t count)
+                        : _chunks(chunks),
+                          _chunk(chunk),
+                          _count(count)
+                    {
+                    }
+
+                    inline reference operator*() const
+                    {
+                        return _chunks[_chunk].values[_index];
+                    }
+
+                    inline pointer operator->() const
+                    {
+                        return &_chunks[_chunk].values[_index];
+                    }
+
+                    inline const_iterator &operator++()
+                    {
+                        if (++_index == _count)
+                        {
+                            _chunk = _chunks[_chunk].next;
+                            _index = 0;
+                            _count = CHUNK_SIZE;
+                        }
+                        return *this;
+                    }
+
+                    inline const_iterator operator++(int)
+                    {
+                        const_iterator previous = *this;
+                        ++(*this);
+                        return previous;
+                    }
+
+                    inline bool operator==(const const_iterator &other) const
+                    {
+                        return _chunk == other._chunk && _index == other._index;
+                    }
+
+                    inline bool operator!=(const const_iterator &other) const
+                    {
+                        return !(*this == other);
+                    }
+
+                private:
+                    const Chunk *_chunks = nullptr;
+                    uint32_t _chunk = NONE;
+                    size_t _index = 0;
+                    size_t _count = 0;
+                };
+
+                inline void push_back(Bucket &bucket, const Value &value)
+                {
+                    size_t position = bucket.length % CHUNK_SIZE;
+
+                    // chunks are prepended, so the chunk with free space is always the one the bucket points to
+                    if (position == 0)
+                    {
+                        _chunks.emplace_back();
+                        _chunks.back().next = bucket.offset;
+                        bucket.offset = _chunks.size() - 1;
+                    }
+
+                    _chunks[bucket.offset].values[position] = value;
+                    bucket.length += 1;
+                }
+
+                // overwrites value with the newest value of the bucket, an emptied chunk is freed by the next reset
+                inline bool erase(Bucket &bucket, const Value &value)
+                {
+                    if (bucket.length == 0)
+                        return false;
+
+                    uint32_t chunk = bucket.offset;
+                    size_t count = (bucket.length - 1) % CHUNK_SIZE + 1;
+                    Value &newest = _chunks[bucket.offset].values[count - 1];
+
+                    while (chunk != NONE)
+                    {
+                        Value *values = _chunks[chunk].values;
+                        Value *found = std::find(values, values + count, value);
+
+                        if (found != values + count)
+                        {
+                            *found = newest;
+                            bucket.length -= 1;
+
+                            if (bucket.length % CHUNK_SIZE == 0)
+                                bucket.offset = _chunks[bucket.offset].next;
+
+                            return true;
+                        }
+
+                        chunk = _chunks[chunk].next;
+                        count = CHUNK_SIZE;
+                    }
+
+                    return false;
+                }
+
+                inline size_t size(const Bucket &bucket) const
+                {
+                    return bucket.length;
+                }
+
+                inline Range<const_iterator> range(const Bucket &bucket) const
+                {
+                    if (bucket.length == 0)
+                        return {const_iterator(), const_iterator()};
+
+                    return {const_iterator(_chunks.data(), bucket.offset, (bucket.length - 1) % CHUNK_SIZE + 1),
+                            const_iterator(_chunks.data(), NONE, 0)};
+                }
+
+                // calls visitor(first, last) for every contiguous run of values, stops as soon as visitor returns false
+                template <typename Visitor>
+                inline bool for_each_span(const Bucket &bucket, Visitor &&visitor) const
+                {
+                    if (bucket.length == 0)
+                        return true;
+
+                    uint32_t chunk = bucket.offset;
+                    size_t count = (bucket.length - 1) % CHUNK_SIZE + 1;
+
+                    while (chunk != NONE)
+                    {
+                        const Value *values = _chunks[chunk].values;
+                        if (!visitor(values, values + count))
+                            return false;
+
+                        chunk = _chunks[chunk].next;
+                        count = CHUNK_SIZE;
+                    }
+
+                    return true;
+                }
+
+            private:
+                std::pmr::vector<Chunk> _chunks;
+            };
+        };
+
+        // the first N values of a bucket live inline next to its header, only crowded buckets spill into an arena
+        template <size_t N = 4, size_t CHUNK_SIZE = 8>
+        struct Inline
+        {
+            static_assert(N > 0, "inline storage needs to hold at least one value");
+
+            template <typename Value>
+            class Store
+            {
+                using Spill = typename Arena<CHUNK_SIZE>::template Store<Value>;
+
+            public:
+                static const bool INDEPENDENT_BUCKETS = false;
+
+                struct Bucket
+                {
+                    uint32_t length = 0;
+                    typename Spill::Bucket spill;
+                    Value values[N] = {};
+                };
+
+                explicit Store(std::pmr::memory_resource *resource)
+                    : _spill(resource)
+                {
+                }
+
+                inline void reset()
+                {
+                    _spill.reset();
+                }
+
+                inline void clear(Bucket &bucket)
+                {
+                    bucket.length = 0;
+                    _spill.clear(bucket.spill);
+                }
+
+                inline size_t bytes(const Bucket &) const
+                {
+                    return 0;
+                }
+
+                inline void trim(Bucket &)
+                {
+                }
+
+                inline void shrink_to_fit()
+                {
+                    _spill.shrink_to_fit();
+                }
+
+                class const_iterator
+                {
+                public:
+                    using iterator_category = std::forward_iterator_tag;
+                    using value_type = Value;
+                    using difference_type = std::ptrdiff_t;
+                    using pointer = const Value *;
+                    using reference = const Value &;
+
+                    const_iterator() = default;
+
+                    const_iterator(const Value *first, const Value *last, typename Spill::const_iterator spill)
+                        : _value(first),
+                          _last(last),
+                          _spill(spill)
+                    {
+                    }
+
+                    inline reference operator*() const
+                    {
+                        return _value != _last ? *_value : *_spill;
+                    }
+
+                    inline pointer operator->() const
+                    {
+                        return &**this;
+                    }
+
+                    inline const_iterator &operator++()
+                    {
+                        if (_value != _last)
+                            ++_value;
+                        else
+                            ++_spill;
+                        return *this;
+                    }
+
+                    inline const_iterator operator++(int)
+                    {
+                        const_iterator previous = *this;
+                        ++(*this);
+                        return previous;
+                    }
+
+                    inline bool operator==(const const_iterator &other) const
+                    {
+                        return _value == other._value && _spill == other._spill;
+                    }
+
+                    inline bool operator!=(const const_iterator &other) const
+                    {
+                        return !(*this == other);
+                    }
+
+                private:
+                    const Value *_value = nullptr;
+                    const Value *_last = nullptr;
+                    typename Spill::const_iterator _spill;
+                };
+
+                inline void push_back(Bucket &bucket, const Value &value)
+                {
+                    if (bucket.length < N)
+                        bucket.values[bucket.length] = value;
+                    else
+                        _spill.push_back(bucket.spill, value);
+
+                    bucket.length += 1;
+                }
+
+                // removes one occurrence of value, an inline hole is refilled from the spill first so that the inline
+                // values always stay in front
+                inline bool erase(Bucket &bucket, const Value &value)
+                {
+                    size_t inlined = std::min<size_t>(bucket.length, N);
+                    Value *found = std::find(bucket.values, bucket.values + inlined, value);
+
+                    if (found == bucket.values + inlined)
+                    {
+                        if (!_spill.erase(bucket.spill, value))
+                            return false;
+                    }
+                    else if (bucket.length > N)
+                    {
+                        Value spilled = *_spill.range(bucket.spill).begin();
+                        _spill.erase(bucket.spill, spilled);
+                        *found = spilled;
+                    }
+                    else
+                    {
+                        *found = bucket.values[inlined - 1];
+                    }
+
+                    bucket.length -= 1;
+                    return true;
+                }
+
+                inline size_t size(const Bucket &bucket) const
+                {
+                    return bucket.length;
+                }
+
+                inline Range<const_iterator> range(const Bucket &bucket) const
+                {
+                    const Value *first = bucket.values;
+                    const Value *last = bucket.values + std::min<size_t>(bucket.length, N);
+                    auto spill = _spill.range(bucket.spill);
+
+                    return {const_iterator(first, last, spill.begin()), const_iterator(last, last, spill.end())};
+                }
+
+                // calls visitor(first, last) for every contiguous run of values, stops as soon as visitor returns false
+                template <typename Visitor>
+                inline bool for_each_span(const Bucket &bucket, Visitor &&visitor) const
+                {
+                    if (bucket.length == 0)
+                        return true;
+
+                    if (!visitor(bucket.values, bucket.values + std::min<size_t>(bucket.length, N)))
+                        return false;
+
+                    return _spill.for_each_span(bucket.spill, visitor);
+                }
+
+            private:
+                Spill _spill;
+            };
+        };
+
+    } // namespace storage
+
+    namespace indexing
+    {
+
+        struct Identity
+        {
+            template <typename Value>
+            inline static size_t index(const Value &value)
+            {
+                return static_cast<size_t>(value);
+            }
+        };
+
+    } // namespace indexing
+
+    // reports every value once per query, starting a new query only bumps the generation
+    template <typename IndexFunction = indexing::Identity>
+    class UniqueFilter
+    {
+    public:
+        inline void reserve(size_t objects)
+        {
+            if (_stamps.size() < objects)
+                _stamps.resize(objects, 0);
+        }
+
+        inline void next_query()
+        {
+            _generation += 1;
+
+            if (_generation == 0)
+            {
+                std::fill(_stamps.begin(), _stamps.end(), 0);
+                _generation = 1;
+            }
+        }
+
+        template <typename Value>
+        inline bool first_visit(const Value &value)
+        {
+            size_t index = IndexFunction::index(value);
+
+            if (index >= _stamps.size())
+                _stamps.resize(std::max(index + 1, _stamps.size() * 2), 0);
+
+            if (_stamps[index] == _generation)
+                return false;
+
+            _stamps[index] = _generation;
+            return true;
+        }
+
+    private:
+        std::vector<uint32_t> _stamps;
+        uint32_t _generation = 0;
+    };
+
+    namespace coordinates
+    {
+        // any cell size, cell = floor(coordinate / cell_size)
+        // integral Real is treated as fixed-point and divided exactly instead of going through double
+        template <typename Real = double>
+        class Scaled
+        {
+        public:
+            using real = Real;
+
+            explicit Scaled(real cell_size)
+            {
+                set_cell_size(cell_size);
+            }
+
+            inline void set_cell_size(real cell_size)
+            {
+                _cell_size = cell_size;
+                _inv_cell_size = (Scale)1 / cell_size;
+            }
+
+            inline int cell(real coordinate) const
+            {
+                if constexpr (std::is_integral<Real>::value)
+                {
+                    // floored division for positive cell sizes
+                    real quotient = coordinate / _cell_size;
+                    return quotient - (coordinate % _cell_size < 0);
+                }
+                else
+                {
+                    return std::floor(coordinate * _inv_cell_size);
+                }
+            }
+
+            // cells per coordinate unit
+            inline double scale() const
+            {
+                return _inv_cell_size;
+            }
+
+        private:
+            using Scale = typename std::conditional<std::is_floating_point<Real>::value, Real, double>::type;
+
+            real _cell_size;
+            Scale _inv_cell_size;
+        };
+
+        // cell size fixed to 2^SHIFT at compile time, the cell size passed at runtime is ignored
+        // cell() is an arithmetic shift for integral Real and a multiplication by a constant otherwise
+        template <int SHIFT, typename Real = int32_t>
+        class PowerOfTwo
+        {
+            static_assert(SHIFT >= 0 && SHIFT < 31, "cell size must be 2^0 to 2^30");
+
+        public:
+            using real = Real;
+
+            static constexpr double SCALE = 1.0 / (1u << SHIFT);
+
+            explicit PowerOfTwo(real)
+            {
+            }
+
+            inline void set_cell_size(real)
+            {
+            }
+
+            inline int cell(real coordinate) const
+            {
+                if constexpr (std::is_integral<Real>::value)
+                    return coordinate >> SHIFT;
+                else
+                    return std::floor(coordinate * (Real)SCALE);
+            }
+
+            inline double scale() const
+            {
+                return SCALE;
+            }
+        };
+
+    } // namespace coordinates
+
+    // what get_bucket records on its hot path, a SpatialHash keeps one Recorder<PROBES> and clears it on every reset
+    namespace statistics
+    {
+
+        // records nothing, every hook compiles away
+        struct None
+        {
+            template <size_t PROBES>
+            struct Recorder
+            {
+                inline void probe(size_t)
+                {
+                }
+
+                inline void reset()
+                {
+                }
+
+                inline std::vector<size_t> probe_lengths() const
+                {
+                    return {};
+                }
+            };
+        };
+
+        // histogram of the probes the get_bucket calls of the current round needed, index i counts the calls that
+        // found or claimed their bucket at probe i + 1
+        struct Probes
+        {
+            template <size_t PROBES>
+            struct Recorder
+            {
+                inline void probe(size_t i)
+                {
+                    _lengths[i] += 1;
+                }
+
+                inline void reset()
+                {
+                    _lengths.fill(0);
+                }
+
+                inline std::vector<size_t> probe_lengths() const
+                {
+                    return std::vector<size_t>(_lengths.begin(), _lengths.end());
+                }
+
+            private:
+                std::array<size_t, PROBES> _lengths = {};
+            };
+        };
+
+    } // namespace statistics
+
+    namespace detail
+    {
+        // cell keys of the bucket tables, hash(key, round) hashes the key for a round, round 0 is the overflow stash
+        template <typename HashFunction>
+        struct PlaneCell
+        {
+            int x;
+            int y;
+            int salt;
+
+            inline bool operator==(const PlaneCell &other) const
+            {
+                return x == other.x && y == other.y && salt == other.salt;
+            }
+
+            inline static HashValue hash(const PlaneCell &key, uint32_t round)
+            {
+                return HashFunction::hash(key.x, key.y, key.salt, round);
+            }
+        };
+
+        template <typename HashFunction, size_t DIMENSIONS>
+        struct VolumeCell
+        {
+            std::array<int, DIMENSIONS> cell;
+            int salt;
+
+            inline bool operator==(const VolumeCell &other) const
+            {
+                return cell == other.cell && salt == other.salt;
+            }
+
+            inline static HashValue hash(const VolumeCell &key, uint32_t round)
+            {
+                return hash_cell<HashFunction, DIMENSIONS>(key.cell, key.salt, round);
+            }
+        };
+
+        // the probed bucket table shared by SpatialHash and SpatialHashN
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        class BucketTable
+        {
+        public:
+            using Store = typename Storage::template Store<Value>;
+
+            struct BucketHeader : CellKey
+            {
+                unsigned int last_claimed = -1;
+            };
+
+            // the cell of a bucket lives in its header only, in the probed header groups
+            struct HashBucket
+            {
+                typename Store::Bucket data;
+            };
+
+            // snapshot of the current round
+            struct Stats
+            {
+                unsigned int round;
+                unsigned int table_size;
+                size_t claimed_buckets;
+                size_t overflow_cells;
+
+                // get_bucket calls that found every probe claimed by other cells
+                size_t exhausted_probes;
+                double mean_probe_length;
+                size_t values;
+                size_t bucket_bytes;
+
+                // recorded by the Statistics policy, empty for statistics::None
+                std::vector<size_t> probe_lengths;
+
+                // [0] counts the buckets of the round that are empty, [k] the ones holding [2^(k-1), 2^k) values
+                std::vector<size_t> bucket_sizes;
+            };
+
+            // the table, the overflow stash and the bucket storage all allocate from resource, which must outlive the
+            // table, table_size is rounded up to whole header groups
+            BucketTable(unsigned int table_size, std::pmr::memory_resource *resource);
+
+            // reset grows the table above max_load_factor or after an overflow and shrinks it below min_load_factor
+            void set_load_factor(double max_load_factor, double min_load_factor = 0.0);
+
+            unsigned int table_size() const;
+
+            // gives back the memory of every bucket not claimed in the current round and the slack of the shared storage
+            void shrink_to_fit();
+
+            // frees stale buckets until the bucket storage holds at most max_bytes, returns the number of bytes freed
+            size_t trim(size_t max_bytes);
+
+            // every reset frees up to buckets_per_reset buckets unclaimed for max_age rounds, 0 disables it
+            void set_trim(unsigned int max_age, size_t buckets_per_reset = 1024);
+
+            // heap memory held by the buckets themselves, shared storage not included
+            size_t bucket_bytes() const;
+
+            // cells claimed in the table since the last reset and the average number of probes it took to claim them
+            size_t claimed_buckets() const;
+            double mean_probe_length() const;
+
+            // walks the table, meant for exporting metrics between frames rather than inside one
+            Stats stats() const;
+
+            // number of get_bucket calls since the last reset that found every probe claimed by other cells and went
+            // to the overflow stash, and the number of distinct cells living there
+            size_t overflows() const;
+            size_t overflow_cells() const;
+
+        protected:
+            // keys in flight per batch of insert_batch and query_batch, enough to cover a DRAM miss
+            static constexpr size_t PREFETCH_BATCH = 16;
+
+            // headers of one cache line, every rehash round probes a whole group
+            static constexpr size_t GROUP_SIZE = sizeof(BucketHeader) < 64 ? 64 / sizeof(BucketHeader) : 1;
+            static constexpr size_t PROBES = (REHASH_ROUNDS + 1) * GROUP_SIZE;
+
+            struct alignas(64) HeaderGroup
+            {
+                BucketHeader headers[GROUP_SIZE];
+            };
+
+            // starts a new round, resizing the table by load factor and trimming stale buckets on the way
+            void next_round(unsigned int table_size);
+
+            const BucketHeader &header(size_t index) const;
+            BucketHeader &header(size_t index);
+
+            // bucket index of probe i, starting from line, the first probe of the current group
+            static size_t probe_index(HashValue line, size_t i);
+            void resize_table(unsigned int table_size);
+
+            // hash of the cell key in the current round, every probe of the cell is derived from it
+            HashValue key_hash(const CellKey &key) const;
+
+            // hash is key_hash(key), its reduction is the first probe
+            // on_claim(key) is called once for every cell claiming a bucket or a slot of the stash in the current round
+            template <typename OnClaim>
+            HashBucket *get_bucket(const CellKey &key, HashValue hash, OnClaim &&on_claim);
+            const HashBucket *find_bucket(const CellKey &key, HashValue hash) const;
+
+            // get_bucket limited to the group of first_probe, returns nullptr if it is full, see record_probe
+            HashBucket *get_bucket_in_group(const CellKey &key, HashValue first_probe, size_t &probe, bool &claimed);
+
+            template <typename OnClaim>
+            void record_probe(const CellKey &key, size_t probe, bool claimed, OnClaim &&on_claim);
+
+            // batched point inserts and lookups, cell_fn(item) returns the CellKey of every item of [first, last)
+            template <typename Iterator, typename CellFunction, typename OnClaim>
+            void insert_batch_cells(Iterator first, Iterator last, CellFunction &&cell_fn, OnClaim &&on_claim);
+
+            template <typename Iterator, typename CellFunction, typename Output>
+            bool query_batch_cells(Iterator first, Iterator last, CellFunction &&cell_fn, Output &&output_fn) const;
+
+            unsigned int _table_size = 0;
+            unsigned int _current_round = 0; // pepper
+
+            struct CellKeyHash
+            {
+                inline size_t operator()(const CellKey &key) const
+                {
+                    return CellKey::hash(key, 0);
+                }
+            };
+
+            // declared first, the buckets of the table may hold memory of the store
+            Store _store;
+            std::pmr::vector<HeaderGroup> _headers;
+            std::pmr::vector<HashBucket> _hash_table;
+
+            // cells whose probes are exhausted, node based so that bucket pointers stay valid
+            std::pmr::unordered_map<CellKey, HashBucket, CellKeyHash> _overflow;
+            size_t _overflows = 0;
+
+            size_t _claimed = 0;
+            size_t _claim_probes = 0;
+            double _max_load_factor = 0.0;
+            double _min_load_factor = 0.0;
+
+            typename Statistics::template Recorder<PROBES> _statistics;
+
+            unsigned int _trim_age = 0;
+            size_t _trim_budget = 0;
+            size_t _trim_cursor = 0;
+        };
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::BucketTable(unsigned int table_size, std::pmr::memory_resource *resource)
+            : _store(resource),
+              _headers(resource),
+              _hash_table(resource),
+              _overflow(resource)
+        {
+            resize_table(table_size);
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::next_round(unsigned int table_size)
+        {
+            if (_max_load_factor > 0.0)
+            {
+                size_t cells = _claimed + _overflow.size();
+                unsigned int needed = std::min<double>(cells / _max_load_factor + 1, UINT32_MAX);
+                unsigned int resized = _table_size;
+
+                if (cells > _max_load_factor * _table_size || !_overflow.empty())
+                    resized = std::max(needed, _table_size * 2);
+                else if (cells < _min_load_factor * _table_size)
+                    resized = std::max(needed, _table_size / 2);
+
+                table_size = std::max(table_size, resized);
+            }
+
+            _current_round += 1;
+
+            // the round counter wrapped onto the never claimed marker, forget every claim so that no header of an old
+            // round matches a reused round number
+            if (_current_round == (unsigned int)-1)
+            {
+                _current_round = 0;
+                std::fill(_headers.begin(), _headers.end(), HeaderGroup());
+            }
+
+            _store.reset();
+            _overflow.clear();
+            _overflows = 0;
+            _claimed = 0;
+            _claim_probes = 0;
+            _statistics.reset();
+
+            resize_table(table_size);
+
+            if (_trim_age > 0)
+            {
+                for (size_t i = 0; i < _trim_budget && i < _hash_table.size(); i++)
+                {
+                    _trim_cursor = (_trim_cursor + 1) % _hash_table.size();
+                    const BucketHeader &head = header(_trim_cursor);
+
+                    if (head.last_claimed != (unsigned int)-1 && _current_round - head.last_claimed >= _trim_age)
+                        _store.trim(_hash_table[_trim_cursor].data);
+                }
+            }
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::resize_table(unsigned int table_size)
+        {
+            // whole groups only, and never less than one so that a table size of 0 still has a bucket to probe
+            table_size = std::max<unsigned int>((table_size + GROUP_SIZE - 1) / GROUP_SIZE * GROUP_SIZE, GROUP_SIZE);
+
+            if (_table_size != table_size)
+            {
+                _table_size = table_size;
+                _headers.resize(_table_size / GROUP_SIZE, HeaderGroup());
+                _hash_table.resize(_table_size, HashBucket());
+            }
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::set_load_factor(double max_load_factor, double min_load_factor)
+        {
+            _max_load_factor = max_load_factor;
+            _min_load_factor = min_load_factor;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::shrink_to_fit()
+        {
+            for (size_t i = 0; i < _hash_table.size(); i++)
+            {
+                if (header(i).last_claimed != _current_round)
+                    _store.trim(_hash_table[i].data);
+            }
+
+            _store.shrink_to_fit();
+            _overflow.rehash(0);
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::trim(size_t max_bytes)
+        {
+            size_t held = bucket_bytes();
+            size_t freed = 0;
+
+            for (size_t i = 0; i < _hash_table.size() && held > max_bytes; i++)
+            {
+                size_t bytes = _store.bytes(_hash_table[i].data);
+
+                if (bytes > 0 && header(i).last_claimed != _current_round)
+                {
+                    _store.trim(_hash_table[i].data);
+                    held -= bytes;
+                    freed += bytes;
+                }
+            }
+
+            return freed;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::set_trim(unsigned int max_age, size_t buckets_per_reset)
+        {
+            _trim_age = max_age;
+            _trim_budget = buckets_per_reset;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::bucket_bytes() const
+        {
+            size_t bytes = 0;
+
+            for (const HashBucket &bucket : _hash_table)
+                bytes += _store.bytes(bucket.data);
+
+            for (const auto &entry : _overflow)
+                bytes += _store.bytes(entry.second.data);
+
+            return bytes;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        unsigned int BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::table_size() const
+        {
+            return _table_size;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::Stats BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::stats() const
+        {
+            Stats stats;
+            stats.round = _current_round;
+            stats.table_size = _table_size;
+            stats.claimed_buckets = _claimed;
+            stats.overflow_cells = _overflow.size();
+            stats.exhausted_probes = _overflows;
+            stats.mean_probe_length = mean_probe_length();
+            stats.values = 0;
+            stats.bucket_bytes = bucket_bytes();
+            stats.probe_lengths = _statistics.probe_lengths();
+
+            auto count = [&stats](size_t size) {
+                size_t bin = 0;
+                while (size >> bin)
+                    bin++;
+
+                if (stats.bucket_sizes.size() <= bin)
+                    stats.bucket_sizes.resize(bin + 1, 0);
+
+                stats.bucket_sizes[bin] += 1;
+                stats.values += size;
+            };
+
+            for (size_t i = 0; i < _hash_table.size(); i++)
+            {
+                if (header(i).last_claimed == _current_round)
+                    count(_store.size(_hash_table[i].data));
+            }
+
+            for (const auto &entry : _overflow)
+                count(_store.size(entry.second.data));
+
+            return stats;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::claimed_buckets() const
+        {
+            return _claimed;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        double BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::mean_probe_length() const
+        {
+            return _claimed == 0 ? 0.0 : (double)_claim_probes / _claimed;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::overflows() const
+        {
+            return _overflows;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::overflow_cells() const
+        {
+            return _overflow.size();
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        const typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::BucketHeader &BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::header(size_t index) const
+        {
+            return _headers[index / GROUP_SIZE].headers[index % GROUP_SIZE];
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::BucketHeader &BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::header(size_t index)
+        {
+            return _headers[index / GROUP_SIZE].headers[index % GROUP_SIZE];
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        size_t BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::probe_index(HashValue line, size_t i)
+        {
+            return line - line % GROUP_SIZE + (line + i) % GROUP_SIZE;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        HashValue BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::key_hash(const CellKey &key) const
+        {
+            return CellKey::hash(key, _current_round + 1);
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        template <typename OnClaim>
+        typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::HashBucket *
+        BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::get_bucket(const CellKey &key, HashValue hash, OnClaim &&on_claim)
+        {
+            HashBucket *bucket;
+            HashValue line = ReduceFunction::reduce(hash, _table_size);
+
+            for (size_t i = 0; i < PROBES; i++)
+            {
+                if (i > 0 && i % GROUP_SIZE == 0)
+                    line = ReduceFunction::reduce(probe_hash(hash, i / GROUP_SIZE), _table_size);
+
+                size_t index = probe_index(line, i);
+                BucketHeader &head = header(index);
+
+                if (head.last_claimed != _current_round)
+                {
+                    head.last_claimed = _current_round;
+                    static_cast<CellKey &>(head) = key;
+
+                    bucket = &_hash_table[index];
+                    _store.clear(bucket->data);
+                    _claimed += 1;
+                    _claim_probes += i + 1;
+                    _statistics.probe(i);
+                    on_claim(key);
+                    return bucket;
+                }
+                else if (static_cast<const CellKey &>(head) == key)
+                {
+                    _statistics.probe(i);
+                    return &_hash_table[index];
+                }
+            }
+
+            _overflows += 1;
+
+            auto inserted = _overflow.try_emplace(key);
+            bucket = &inserted.first->second;
+
+            if (inserted.second)
+                on_claim(key);
+
+            return bucket;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        const typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::HashBucket *
+        BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::find_bucket(const CellKey &key, HashValue hash) const
+        {
+            HashValue line = ReduceFunction::reduce(hash, _table_size);
+
+            for (size_t i = 0; i < PROBES; i++)
+            {
+                if (i > 0 && i % GROUP_SIZE == 0)
+                    line = ReduceFunction::reduce(probe_hash(hash, i / GROUP_SIZE), _table_size);
+
+                size_t index = probe_index(line, i);
+                const BucketHeader &head = header(index);
+
+                // an unclaimed bucket ends the probe sequence, the insert would have claimed it
+                if (head.last_claimed != _current_round)
+                    return nullptr;
+                else if (static_cast<const CellKey &>(head) == key)
+                    return &_hash_table[index];
+            }
+
+            if (_overflow.empty())
+                return nullptr;
+
+            auto found = _overflow.find(key);
+            return found == _overflow.end() ? nullptr : &found->second;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        typename BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::HashBucket *
+        BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::get_bucket_in_group(const CellKey &key, HashValue first_probe, size_t &probe, bool &claimed)
+        {
+            for (size_t i = 0; i < GROUP_SIZE; i++)
+            {
+                size_t index = probe_index(first_probe, i);
+                BucketHeader &head = header(index);
+
+                if (head.last_claimed != _current_round)
+                {
+                    head.last_claimed = _current_round;
+                    static_cast<CellKey &>(head) = key;
+
+                    _store.clear(_hash_table[index].data);
+                    probe = i;
+                    claimed = true;
+                    return &_hash_table[index];
+                }
+                else if (static_cast<const CellKey &>(head) == key)
+                {
+                    probe = i;
+                    claimed = false;
+                    return &_hash_table[index];
+                }
+            }
+
+            return nullptr;
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        template <typename OnClaim>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::record_probe(const CellKey &key, size_t probe, bool claimed, OnClaim &&on_claim)
+        {
+            if (claimed)
+            {
+                _claimed += 1;
+                _claim_probes += probe + 1;
+                on_claim(key);
+            }
+
+            _statistics.probe(probe);
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        template <typename Iterator, typename CellFunction, typename OnClaim>
+        void BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::insert_batch_cells(Iterator first, Iterator last, CellFunction &&cell_fn, OnClaim &&on_claim)
+        {
+            struct Lookup
+            {
+                CellKey key;
+                HashValue hash;
+            };
+
+            Lookup lookups[PREFETCH_BATCH];
+
+            while (first != last)
+            {
+                Iterator batch = first;
+                size_t count = 0;
+
+                // hash every key of the batch and request its header group
+                for (; count < PREFETCH_BATCH && first != last; count++, ++first)
+                {
+                    Lookup &lookup = lookups[count];
+
+                    lookup.key = cell_fn(*first);
+                    lookup.hash = key_hash(lookup.key);
+
+                    HashValue first_probe = ReduceFunction::reduce(lookup.hash, _table_size);
+                    prefetch(&header(first_probe));
+                    prefetch(&_hash_table[first_probe]);
+                }
+
+                for (size_t i = 0; i < count; i++, ++batch)
+                {
+                    const Lookup &lookup = lookups[i];
+                    _store.push_back(get_bucket(lookup.key, lookup.hash, on_claim)->data, *batch);
+                }
+            }
+        }
+
+        template <typename CellKey, typename Value, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Statistics>
+        template <typename Iterator, typename CellFunction, typename Output>
+        bool BucketTable<CellKey, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>::query_batch_cells(Iterator first, Iterator last, CellFunction &&cell_fn, Output &&output_fn) const
+        {
+            struct Lookup
+            {
+                CellKey key;
+                HashValue hash;
+                const HashBucket *bucket;
+            };
+
+            Lookup lookups[PREFETCH_BATCH];
+            size_t index = 0;
+
+            while (first != last)
+            {
+                size_t count = 0;
+
+                // stage one, hash every key of the batch and request its header group
+                for (; count < PREFETCH_BATCH && first != last; count++, ++first)
+                {
+                    Lookup &lookup = lookups[count];
+
+                    lookup.key = cell_fn(*first);
+                    lookup.hash = key_hash(lookup.key);
+                    prefetch(&header(ReduceFunction::reduce(lookup.hash, _table_size)));
+                }
+
+                // stage two, walk the now cached headers and request the payload of every matched bucket
+                for (size_t i = 0; i < count; i++)
+                {
+                    Lookup &lookup = lookups[i];
+                    lookup.bucket = find_bucket(lookup.key, lookup.hash);
+
+                    if (lookup.bucket != nullptr)
+                        prefetch(lookup.bucket);
+                }
+
+                // stage three, hand out the values
+                for (size_t i = 0; i < count; i++, index++)
+                {
+                    const HashBucket *bucket = lookups[i].bucket;
+                    if (bucket == nullptr)
+                        continue;
+
+                    bool completed = _store.for_each_span(bucket->data, [&output_fn, index](const Value *span_first, const Value *span_last) {
+                        return visit(output_fn, index, span_first, span_last);
+                    });
+
+                    if (!completed)
+                        return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    using real = double;
+
+    template <typename Value, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>, typename Statistics = statistics::None>
+    class SpatialHash : public detail::BucketTable<detail::PlaneCell<HashFunction>, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>
+    {
+        using Table = detail::BucketTable<detail::PlaneCell<HashFunction>, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>;
+
+    public:
+        using real = typename Coordinates::real;
+        using Store = typename Table::Store;
+        using BucketHeader = typename Table::BucketHeader;
+        using HashBucket = typename Table::HashBucket;
+        using Stats = typename Table::Stats;
+        using BucketRange = decltype(std::declval<const Store &>().range(std::declval<const typename Store::Bucket &>()));
+
+        struct Key
+        {
+            real x;
+            real y;
+            int salt = 0;
+        };
+
+        struct Bounds
+        {
+            real top_left_x;
+            real top_left_y;
+            real bottom_right_x;
+            real bottom_right_y;
+        };
+
+        struct Neighbour
+        {
+            Value value;
+            double distance_squared;
+        };
+
+        SpatialHash();
+
+        // the table, the overflow stash and the bucket storage all allocate from resource, which must outlive the hash
+        SpatialHash(
+            real cell_size,
+            unsigned int table_size,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        void reset(real cell_size, unsigned int table_size);
+
+        void insert_at_cell(
+            int x,
+            int y,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_point(
+            real x,
+            real y,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_segment(
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            Value &value,
+            int salt = 0);
+
+        void query_at_cell(
+            std::vector<Value> &result,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        void query_at_segment(
+            std::vector<Value> &result,
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            int salt = 0) const;
+
+        // only the cells intersecting the disc are looked up, row by row
+        void query_at_radius(
+            std::vector<Value> &result,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        // remove_* take out one occurrence of value per cell and return false if it was missing in any of them
+        bool remove_at_cell(
+            int x,
+            int y,
+            const Value &value,
+            int salt = 0);
+
+        bool remove_at_point(
+            real x,
+            real y,
+            const Value &value,
+            int salt = 0);
+
+        bool remove_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            const Value &value,
+            int salt = 0);
+
+        // move_* only touch the cells whose membership changes, false if value is missing from a cell it would leave
+        bool move_at_point(
+            real old_x,
+            real old_y,
+            real new_x,
+            real new_y,
+            Value &value,
+            int salt = 0);
+
+        bool move_at_aabb(
+            real old_top_left_x,
+            real old_top_left_y,
+            real old_bottom_right_x,
+            real old_bottom_right_y,
+            real new_top_left_x,
+            real new_top_left_y,
+            real new_bottom_right_x,
+            real new_bottom_right_y,
+            Value &value,
+            int salt = 0);
+
+        // inserts every value of [first, last) at the point key_fn(value) returns, at most 2^32 values per call
+        template <typename Iterator, typename KeyFunction>
+        void bulk_insert(
+            Iterator first,
+            Iterator last,
+            KeyFunction &&key_fn,
+            unsigned int threads = 1);
+
+        // point inserts and queries at key_fn(item) for every item of [first, last), prefetched a batch at a time
+        template <typename Iterator, typename KeyFunction>
+        void insert_batch(
+            Iterator first,
+            Iterator last,
+            KeyFunction &&key_fn);
+
+        // calls output_fn(index, first, last) for every span found, returns false if output_fn stopped the batch
+        template <typename Iterator, typename KeyFunction, typename Output>
+        bool query_batch(
+            Iterator first,
+            Iterator last,
+            KeyFunction &&key_fn,
+            Output &&output_fn) const;
+
+        // visitor(value) is called for every value without copying, returning false from it stops the walk
+        // every for_each_* returns false if the walk was stopped early
+        template <typename Visitor>
+        bool for_each_at_cell(
+            Visitor &&visitor,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_segment(
+            Visitor &&visitor,
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_radius(
+            Visitor &&visitor,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        // same cells as for_each_at_radius, but visited ring by ring around the center cell, nearer rings first
+        template <typename Visitor>
+        bool for_each_at_radius_outward(
+            Visitor &&visitor,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        // visitor(first, last) is called for every contiguous run of values inside the buckets
+        template <typename Visitor>
+        bool for_each_span_at_cell(
+            Visitor &&visitor,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_span_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_span_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_span_at_segment(
+            Visitor &&visitor,
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_span_at_radius(
+            Visitor &&visitor,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        // same as above, but every value is reported once per query even if it was inserted into several cells
+        template <typename IndexFunction>
+        void query_at_aabb(
+            std::vector<Value> &result,
+            UniqueFilter<IndexFunction> &filter,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename IndexFunction>
+        void query_at_segment(
+            std::vector<Value> &result,
+            UniqueFilter<IndexFunction> &filter,
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            int salt = 0) const;
+
+        template <typename Visitor, typename IndexFunction>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            UniqueFilter<IndexFunction> &filter,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor, typename IndexFunction>
+        bool for_each_at_segment(
+            Visitor &&visitor,
+            UniqueFilter<IndexFunction> &filter,
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            int salt = 0) const;
+
+        // calls visitor(value, t_enter, t_exit) for the cells along the ray in order, returning false stops the ray
+        template <typename Visitor>
+        bool raycast(
+            Visitor &&visitor,
+            real origin_x,
+            real origin_y,
+            real direction_x,
+            real direction_y,
+            double max_t,
+            int salt = 0) const;
+
+        // the k values closest to (x, y) by position_fn(value) sorted by distance, each once, Value needs an operator==
+        // result is used as the heap and does not allocate once it holds k neighbours
+        template <typename PositionFunction>
+        void query_knn(
+            std::vector<Neighbour> &result,
+            real x,
+            real y,
+            size_t k,
+            PositionFunction &&position_fn,
+            int salt = 0) const;
+
+        // calls callback(a, b) once for every two values sharing a cell, returning false stops the walk
+        // every value must have been inserted at bounds_fn(value)
+        template <typename Callback, typename BoundsFunction>
+        bool for_each_potential_pair(
+            Callback &&callback,
+            BoundsFunction &&bounds_fn) const;
+
+        // same pairs, the buckets are split across threads and every thread appends to its own result[thread]
+        template <typename BoundsFunction>
+        void query_potential_pairs(
+            std::vector<std::vector<std::pair<Value, Value>>> &result,
+            BoundsFunction &&bounds_fn,
+            unsigned int threads = 1) const;
+
+        // iterable view into the bucket, valid until the next insert or reset
+        BucketRange range_at_cell(
+            int x,
+            int y,
+            int salt = 0) const;
+
+        BucketRange range_at_point(
+            real x,
+            real y,
+            int salt = 0) const;
+
+        //private:
+        int cell(real coordinate) const;
+        HashBucket *get_bucket(int x, int y, int salt);
+
+        // continuous coordinate in cell units, for the traversals that need more than the cell index
+        double to_cells(real coordinate) const;
+
+        // never claims a bucket, returns nullptr if nothing was inserted at the cell in the current round
+        const HashBucket *find_bucket(int x, int y, int salt) const;
+
+    private:
+        using CellKey = detail::PlaneCell<HashFunction>;
+
+        using Table::GROUP_SIZE;
+        using Table::_current_round;
+        using Table::_hash_table;
+        using Table::_overflow;
+        using Table::_store;
+        using Table::_table_size;
+        using Table::header;
+
+        static constexpr int ROW_BATCH = 16;
+
+        // hash of the cell key in the current round, every probe of the cell is derived from it
+        HashValue key_hash(int x, int y, int salt) const;
+
+        // key hashes of the cells (x + i, y) for i in [0, count), hashed as one batch if the hash function supports it
+        void key_hash_row(int x, int y, int salt, HashValue *hashes, size_t count) const;
+
+        // calls cell_visitor(x, y, key_hash) for every cell of the inclusive rectangle, row by row
+        template <typename CellVisitor>
+        bool for_each_hashed_cell_in_aabb(int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt, CellVisitor &&cell_visitor) const;
+
+        HashBucket *get_bucket(int x, int y, int salt, HashValue hash);
+        const HashBucket *find_bucket(int x, int y, int salt, HashValue hash) const;
+
+        // a value of a bucket together with the first cell its bounds cover
+        struct PairCandidate
+        {
+            const Value *value;
+            int x;
+            int y;
+        };
+
+        template <typename Callback, typename BoundsFunction>
+        bool for_each_pair_in_bucket(
+            int x,
+            int y,
+            const HashBucket &bucket,
+            std::vector<PairCandidate> &candidates,
+            Callback &callback,
+            BoundsFunction &bounds_fn) const;
+
+        void extend_claimed_bounds(int x, int y);
+
+        Coordinates _coordinates;
+
+        // bounding box of the cells claimed since the last reset, empty while min > max
+        int _claimed_min_x = std::numeric_limits<int>::max();
+        int _claimed_min_y = std::numeric_limits<int>::max();
+        int _claimed_max_x = std::numeric_limits<int>::min();
+        int _claimed_max_y = std::numeric_limits<int>::min();
+    };
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::SpatialHash()
+        : SpatialHash(1, 1024)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::SpatialHash(
+        real cell_size,
+        unsigned int table_size,
+        std::pmr::memory_resource *resource)
+        : Table(table_size, resource),
+          _coordinates(cell_size)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::reset(real cell_size, unsigned int table_size)
+    {
+        _coordinates.set_cell_size(cell_size);
+        Table::next_round(table_size);
+
+        _claimed_min_x = _claimed_min_y = std::numeric_limits<int>::max();
+        _claimed_max_x = _claimed_max_y = std::numeric_limits<int>::min();
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_cell(
+        int x,
+        int y,
+        Value &value,
+        int salt)
+    {
+        HashBucket *bucket = get_bucket(x, y, salt);
+        _store.push_back(bucket->data, value);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_point(
+        real x,
+        real y,
+        Value &value,
+        int salt)
+    {
+        int cell_x = cell(x);
+        int cell_y = cell(y);
+
+        insert_at_cell(cell_x, cell_y, value, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        Value &value,
+        int salt)
+    {
+        for_each_hashed_cell_in_aabb(
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y), salt,
+            [this, &value, salt](int x, int y, HashValue hash) {
+                _store.push_back(get_bucket(x, y, salt, hash)->data, value);
+                return true;
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_segment(
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        Value &value,
+        int salt)
+    {
+        double x0 = to_cells(start_x_coord);
+        double y0 = to_cells(start_y_coord);
+
+        detail::for_each_cell_on_ray(
+            x0, y0, to_cells(end_x_coord) - x0, to_cells(end_y_coord) - y0, 1.0,
+            [&](int x, int y, double, double) {
+                insert_at_cell(x, y, value, salt);
+                return true;
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_cell(
+        std::vector<Value> &result,
+        int x,
+        int y,
+        int salt) const
+    {
+        for_each_span_at_cell([&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); }, x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_point(
+        std::vector<Value> &result,
+        real x,
+        real y,
+        int salt) const
+    {
+        for_each_span_at_point([&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); }, x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_span_at_aabb(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_segment(
+        std::vector<Value> &result,
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        int salt) const
+    {
+        for_each_span_at_segment(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            start_x_coord, start_y_coord, end_x_coord, end_y_coord, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_radius(
+        std::vector<Value> &result,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        for_each_span_at_radius(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            center_x, center_y, radius, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_cell(
+        int x,
+        int y,
+        const Value &value,
+        int salt)
+    {
+        HashBucket *bucket = const_cast<HashBucket *>(find_bucket(x, y, salt));
+        if (bucket == nullptr)
+            return false;
+
+        return _store.erase(bucket->data, value);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_point(
+        real x,
+        real y,
+        const Value &value,
+        int salt)
+    {
+        return remove_at_cell(cell(x), cell(y), value, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        const Value &value,
+        int salt)
+    {
+        bool removed = true;
+
+        detail::for_each_cell_in_aabb(
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y),
+            [&](int x, int y) {
+                removed &= remove_at_cell(x, y, value, salt);
+                return true;
+            });
+
+        return removed;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::move_at_point(
+        real old_x,
+        real old_y,
+        real new_x,
+        real new_y,
+        Value &value,
+        int salt)
+    {
+        int old_cell_x = cell(old_x);
+        int old_cell_y = cell(old_y);
+        int new_cell_x = cell(new_x);
+        int new_cell_y = cell(new_y);
+
+        if (old_cell_x == new_cell_x && old_cell_y == new_cell_y)
+            return true;
+
+        if (!remove_at_cell(old_cell_x, old_cell_y, value, salt))
+            return false;
+
+        insert_at_cell(new_cell_x, new_cell_y, value, salt);
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::move_at_aabb(
+        real old_top_left_x,
+        real old_top_left_y,
+        real old_bottom_right_x,
+        real old_bottom_right_y,
+        real new_top_left_x,
+        real new_top_left_y,
+        real new_bottom_right_x,
+        real new_bottom_right_y,
+        Value &value,
+        int salt)
+    {
+        int old_left = cell(old_top_left_x);
+        int old_top = cell(old_top_left_y);
+        int old_right = cell(old_bottom_right_x);
+        int old_bottom = cell(old_bottom_right_y);
+        int new_left = cell(new_top_left_x);
+        int new_top = cell(new_top_left_y);
+        int new_right = cell(new_bottom_right_x);
+        int new_bottom = cell(new_bottom_right_y);
+
+        if (old_left == new_left && old_top == new_top && old_right == new_right && old_bottom == new_bottom)
+            return true;
+
+        auto leaves = [&](int x, int y) {
+            return x < new_left || x > new_right || y < new_top || y > new_bottom;
+        };
+
+        size_t removed = 0;
+        bool found = detail::for_each_cell_in_aabb(old_left, old_top, old_right, old_bottom, [&](int x, int y) {
+            if (!leaves(x, y))
+                return true;
+            if (!remove_at_cell(x, y, value, salt))
+                return false;
+            removed += 1;
+            return true;
+        });
+
+        // the old aabb was wrong, put value back into the cells it already left
+        if (!found)
+        {
+            detail::for_each_cell_in_aabb(old_left, old_top, old_right, old_bottom, [&](int x, int y) {
+                if (removed == 0)
+                    return false;
+                if (leaves(x, y))
+                {
+                    insert_at_cell(x, y, value, salt);
+                    removed -= 1;
+                }
+                return true;
+            });
+
+            return false;
+        }
+
+        detail::for_each_cell_in_aabb(new_left, new_top, new_right, new_bottom, [&](int x, int y) {
+            if (x < old_left || x > old_right || y < old_top || y > old_bottom)
+                insert_at_cell(x, y, value, salt);
+            return true;
+        });
+
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Iterator, typename KeyFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::bulk_insert(
+        Iterator first,
+        Iterator last,
+        KeyFunction &&key_fn,
+        unsigned int threads)
+    {
+        struct Entry
+        {
+            int x;
+            int y;
+            int salt;
+            HashValue hash;
+            HashValue bucket;
+            uint32_t index;
+        };
+
+        struct Run
+        {
+            size_t begin;
+            size_t end;
+            HashBucket *bucket;
+            size_t probe;
+            bool claimed;
+        };
+
+        size_t count = std::distance(first, last);
+        if (count == 0)
+            return;
+
+        threads = std::max(1u, threads);
+        size_t partitions = threads;
+        // whole header groups, so the first group of every cell lies in a single partition
+        auto partition_of = [this, partitions](HashValue bucket) {
+            return (size_t)((uint64_t)(bucket / GROUP_SIZE) * partitions / (_table_size / GROUP_SIZE));
+        };
+
+        // overflow buckets all go to the last partition
+        auto bucket_partition = [this, partitions, &partition_of](const HashBucket *bucket) {
+            std::less<const HashBucket *> before;
+            if (before(bucket, _hash_table.data()) || !before(bucket, _hash_table.data() + _table_size))
+                return partitions - 1;
+
+            return partition_of(bucket - _hash_table.data());
+        };
+
+        std::vector<Entry> entries(count);
+        std::vector<Entry> partitioned(count);
+        std::vector<size_t> offsets(threads * partitions, 0);
+        std::vector<size_t> partition_begin(partitions + 1, 0);
+
+        // cells and first probes, counted per thread and partition
+        detail::parallel_for(threads, count, [&](size_t thread, size_t begin, size_t end) {
+            size_t *counts = &offsets[thread * partitions];
+
+            for (size_t i = begin; i < end; i++)
+            {
+                Key key = key_fn(*(first + i));
+                Entry &entry = entries[i];
+
+                entry.x = cell(key.x);
+                entry.y = cell(key.y);
+                entry.salt = key.salt;
+                entry.hash = key_hash(entry.x, entry.y, entry.salt);
+                entry.bucket = ReduceFunction::reduce(entry.hash, _table_size);
+                entry.index = i;
+
+                counts[partition_of(entry.bucket)] += 1;
+            }
+        });
+
+        // prefix sum, turns the counts into the scatter offset of every thread inside every partition
+        size_t offset = 0;
+        for (size_t partition = 0; partition < partitions; partition++)
+        {
+            partition_begin[partition] = offset;
+            for (size_t thread = 0; thread < threads; thread++)
+            {
+                size_t partition_count = offsets[thread * partitions + partition];
+                offsets[thread * partitions + partition] = offset;
+                offset += partition_count;
+            }
+        }
+        partition_begin[partitions] = offset;
+
+        detail::parallel_for(threads, count, [&](size_t thread, size_t begin, size_t end) {
+            size_t *scatter = &offsets[thread * partitions];
+
+            for (size_t i = begin; i < end; i++)
+                partitioned[scatter[partition_of(entries[i].bucket)]++] = entries[i];
+        });
+
+        // equal cells share their first probe, the input index keeps the order of serial insertion
+        detail::parallel_for(threads, partitions, [&](size_t, size_t begin, size_t end) {
+            for (size_t partition = begin; partition < end; partition++)
+            {
+                std::sort(
+                    partitioned.begin() + partition_begin[partition],
+                    partitioned.begin() + partition_begin[partition + 1],
+                    [](const Entry &a, const Entry &b) {
+                        if (a.bucket != b.bucket)
+                            return a.bucket < b.bucket;
+                        if (a.x != b.x)
+                            return a.x < b.x;
+                        if (a.y != b.y)
+                            return a.y < b.y;
+                        if (a.salt != b.salt)
+                            return a.salt < b.salt;
+                        return a.index < b.index;
+                    });
+            }
+        });
+
+        // every partition claims the cells whose first group has room, the rest walk their whole probe sequence on the
+        // calling thread afterwards
+        std::vector<std::vector<Run>> partition_runs(partitions);
+        detail::parallel_for(threads, partitions, [&](size_t, size_t begin, size_t end) {
+            for (size_t partition = begin; partition < end; partition++)
+            {
+                size_t partition_end = partition_begin[partition + 1];
+
+                for (size_t run_begin = partition_begin[partition]; run_begin < partition_end;)
+                {
+                    const Entry &entry = partitioned[run_begin];
+
+                    size_t run_end = run_begin + 1;
+                    while (run_end < partition_end &&
+                           partitioned[run_end].x == entry.x &&
+                           partitioned[run_end].y == entry.y &&
+                           partitioned[run_end].salt == entry.salt)
+                        run_end++;
+
+                    Run run = {run_begin, run_end, nullptr, 0, false};
+                    run.bucket = Table::get_bucket_in_group({entry.x, entry.y, entry.salt}, entry.bucket, run.probe, run.claimed);
+                    partition_runs[partition].push_back(run);
+
+                    run_begin = run_end;
+                }
+            }
+        });
+
+        std::vector<Run> runs;
+        std::vector<size_t> run_counts(partitions + 1, 0);
+        for (auto &partition : partition_runs)
+        {
+            for (Run &run : partition)
+            {
+                const Entry &entry = partitioned[run.begin];
+
+                if (run.bucket == nullptr)
+                {
+                    run.bucket = get_bucket(entry.x, entry.y, entry.salt, entry.hash);
+                }
+                else
+                {
+                    Table::record_probe({entry.x, entry.y, entry.salt}, run.probe, run.claimed, [this](const CellKey &key) {
+                        extend_claimed_bounds(key.x, key.y);
+                    });
+                }
+
+                runs.push_back(run);
+                run_counts[bucket_partition(run.bucket) + 1] += 1;
+            }
+        }
+
+        // partitioning the runs again by their bucket keeps every bucket on a single thread
+        for (size_t partition = 0; partition < partitions; partition++)
+            run_counts[partition + 1] += run_counts[partition];
+
+        std::vector<Run> partitioned_runs(runs.size());
+        std::vector<size_t> run_scatter(run_counts.begin(), run_counts.end() - 1);
+        for (auto &run : runs)
+            partitioned_runs[run_scatter[bucket_partition(run.bucket)]++] = run;
+
+        auto fill = [&](size_t, size_t begin, size_t end) {
+            for (size_t partition = begin; partition < end; partition++)
+            {
+                for (size_t r = run_counts[partition]; r < run_counts[partition + 1]; r++)
+                {
+                    const Run &run = partitioned_runs[r];
+                    for (size_t i = run.begin; i < run.end; i++)
+                        _store.push_back(run.bucket->data, *(first + partitioned[i].index));
+                }
+            }
+        };
+
+        // memory resources are rarely thread safe, so every bucket allocates its capacity here on the calling thread
+        // and the parallel fill only writes into memory it already owns
+        if constexpr (Store::INDEPENDENT_BUCKETS)
+        {
+            if (threads > 1)
+            {
+                for (const Run &run : runs)
+                    _store.reserve(run.bucket->data, run.end - run.begin);
+
+                detail::parallel_for(threads, partitions, fill);
+                return;
+            }
+        }
+
+        fill(0, 0, partitions);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Iterator, typename KeyFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_batch(
+        Iterator first,
+        Iterator last,
+        KeyFunction &&key_fn)
+    {
+        Table::insert_batch_cells(
+            first, last,
+            [this, &key_fn](auto &&item) {
+                Key key = key_fn(item);
+                return CellKey{cell(key.x), cell(key.y), key.salt};
+            },
+            [this](const CellKey &key) { extend_claimed_bounds(key.x, key.y); });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Iterator, typename KeyFunction, typename Output>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_batch(
+        Iterator first,
+        Iterator last,
+        KeyFunction &&key_fn,
+        Output &&output_fn) const
+    {
+        return Table::query_batch_cells(
+            first, last,
+            [this, &key_fn](auto &&item) {
+                Key key = key_fn(item);
+                return CellKey{cell(key.x), cell(key.y), key.salt};
+            },
+            output_fn);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_cell(
+        Visitor &&visitor,
+        int x,
+        int y,
+        int salt) const
+    {
+        return for_each_span_at_cell(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        int salt) const
+    {
+        return for_each_at_cell(visitor, cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        return for_each_span_at_aabb(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_segment(
+        Visitor &&visitor,
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        int salt) const
+    {
+        return for_each_span_at_segment(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            start_x_coord, start_y_coord, end_x_coord, end_y_coord, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_cell(
+        Visitor &&visitor,
+        int x,
+        int y,
+        int salt) const
+    {
+        const HashBucket *bucket = find_bucket(x, y, salt);
+        if (bucket == nullptr)
+            return true;
+
+        return _store.for_each_span(bucket->data, [&visitor](const Value *first, const Value *last) {
+            return detail::visit(visitor, first, last);
+        });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        int salt) const
+    {
+        return for_each_span_at_cell(visitor, cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        return for_each_hashed_cell_in_aabb(
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y), salt,
+            [this, &visitor, salt](int x, int y, HashValue hash) {
+                const HashBucket *bucket = find_bucket(x, y, salt, hash);
+                if (bucket == nullptr)
+                    return true;
+
+                return _store.for_each_span(bucket->data, [&visitor](const Value *first, const Value *last) {
+                    return detail::visit(visitor, first, last);
+                });
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_radius(
+        Visitor &&visitor,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        return for_each_span_at_radius(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            center_x, center_y, radius, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_radius_outward(
+        Visitor &&visitor,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        if (radius < 0.0)
+            return true;
+
+        double x = to_cells(center_x);
+        double y = to_cells(center_y);
+        double r = to_cells(radius);
+        int rings = std::ceil(r) + 1;
+
+        for (int ring = 0; ring <= rings; ring++)
+        {
+            bool done = detail::for_each_cell_on_ring(
+                cell(center_x), cell(center_y), ring,
+                [&](int cell_x, int cell_y) {
+                    if (detail::cell_distance_squared(x, y, cell_x, cell_y) > r * r)
+                        return true;
+
+                    return for_each_at_cell(visitor, cell_x, cell_y, salt);
+                });
+
+            if (!done)
+                return false;
+        }
+
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_radius(
+        Visitor &&visitor,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        return detail::for_each_row_in_disc(
+            to_cells(center_x), to_cells(center_y), to_cells(radius),
+            [&](int first_x, int last_x, int y) {
+                return for_each_hashed_cell_in_aabb(
+                    first_x, y, last_x, y, salt,
+                    [this, &visitor, salt](int x, int y, HashValue hash) {
+                        const HashBucket *bucket = find_bucket(x, y, salt, hash);
+                        if (bucket == nullptr)
+                            return true;
+
+                        return _store.for_each_span(bucket->data, [&visitor](const Value *first, const Value *last) {
+                            return detail::visit(visitor, first, last);
+                        });
+                    });
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_segment(
+        Visitor &&visitor,
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        int salt) const
+    {
+        double x0 = to_cells(start_x_coord);
+        double y0 = to_cells(start_y_coord);
+
+        return detail::for_each_cell_on_ray(
+            x0, y0, to_cells(end_x_coord) - x0, to_cells(end_y_coord) - y0, 1.0,
+            [&](int x, int y, double, double) {
+                return for_each_span_at_cell(visitor, x, y, salt);
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::raycast(
+        Visitor &&visitor,
+        real origin_x,
+        real origin_y,
+        real direction_x,
+        real direction_y,
+        double max_t,
+        int salt) const
+    {
+        return detail::for_each_cell_on_ray(
+            to_cells(origin_x), to_cells(origin_y),
+            to_cells(direction_x), to_cells(direction_y), max_t,
+            [&](int x, int y, double t_enter, double t_exit) {
+                return for_each_span_at_cell(
+                    [&](const Value *first, const Value *last) {
+                        for (const Value *value = first; value != last; value++)
+                        {
+                            if (!detail::visit(visitor, *value, t_enter, t_exit))
+                                return false;
+                        }
+                        return true;
+                    },
+                    x, y, salt);
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename IndexFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_aabb(
+        std::vector<Value> &result,
+        UniqueFilter<IndexFunction> &filter,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_at_aabb(
+            [&result](const Value &value) { result.push_back(value); },
+            filter, top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename IndexFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_segment(
+        std::vector<Value> &result,
+        UniqueFilter<IndexFunction> &filter,
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        int salt) const
+    {
+        for_each_at_segment(
+            [&result](const Value &value) { result.push_back(value); },
+            filter, start_x_coord, start_y_coord, end_x_coord, end_y_coord, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor, typename IndexFunction>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_aabb(
+        Visitor &&visitor,
+        UniqueFilter<IndexFunction> &filter,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        filter.next_query();
+
+        return for_each_at_aabb(
+            [&visitor, &filter](const Value &value) {
+                return !filter.first_visit(value) || detail::visit(visitor, value);
+            },
+            top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor, typename IndexFunction>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_segment(
+        Visitor &&visitor,
+        UniqueFilter<IndexFunction> &filter,
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        int salt) const
+    {
+        filter.next_query();
+
+        return for_each_at_segment(
+            [&visitor, &filter](const Value &value) {
+                return !filter.first_visit(value) || detail::visit(visitor, value);
+            },
+            start_x_coord, start_y_coord, end_x_coord, end_y_coord, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename PositionFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_knn(
+        std::vector<Neighbour> &result,
+        real x,
+        real y,
+        size_t k,
+        PositionFunction &&position_fn,
+        int salt) const
+    {
+        result.clear();
+
+        if (k == 0 || _claimed_min_x > _claimed_max_x)
+            return;
+
+        // max heap on the distance, the current k-th best sits in front
+        auto closer = [](const Neighbour &a, const Neighbour &b) { return a.distance_squared < b.distance_squared; };
+
+        double cell_x = to_cells(x);
+        double cell_y = to_cells(y);
+        double inv_cell_area = _coordinates.scale() * _coordinates.scale();
+        int x0 = cell(x);
+        int y0 = cell(y);
+
+        // distance from (x, y) to the border of its own cell, in cell units
+        double margin = std::min(std::min(cell_x - x0, x0 + 1 - cell_x), std::min(cell_y - y0, y0 + 1 - cell_y));
+
+        // rings that miss the claimed bounding box hold nothing, neither are they walked nor are their empty cells
+        int first_ring = std::max(
+            std::max(std::max(_claimed_min_x - x0, x0 - _claimed_max_x), 0),
+            std::max(std::max(_claimed_min_y - y0, y0 - _claimed_max_y), 0));
+
+        for (int ring = first_ring;; ring++)
+        {
+            if (ring > first_ring && result.size() == k)
+            {
+                double ring_distance = ring - 1 + margin;
+                if (ring_distance * ring_distance > result.front().distance_squared * inv_cell_area)
+                    break;
+            }
+
+            detail::for_each_cell_on_ring_in_aabb(x0, y0, ring, _claimed_min_x, _claimed_min_y, _claimed_max_x, _claimed_max_y, [&](int cx, int cy) {
+                if (result.size() == k &&
+                    detail::cell_distance_squared(cell_x, cell_y, cx, cy) > result.front().distance_squared * inv_cell_area)
+                    return true;
+
+                return for_each_at_cell(
+                    [&](const Value &value) {
+                        Key key = position_fn(value);
+                        double dx = (double)key.x - x;
+                        double dy = (double)key.y - y;
+                        double distance_squared = dx * dx + dy * dy;
+
+                        if (result.size() == k && distance_squared >= result.front().distance_squared)
+                            return;
+
+                        for (const Neighbour &neighbour : result)
+                        {
+                            if (neighbour.value == value)
+                                return;
+                        }
+
+                        if (result.size() == k)
+                        {
+                            std::pop_heap(result.begin(), result.end(), closer);
+                            result.pop_back();
+                        }
+
+                        result.push_back({value, distance_squared});
+                        std::push_heap(result.begin(), result.end(), closer);
+                    },
+                    cx, cy, salt);
+            });
+
+            if (x0 - ring <= _claimed_min_x && x0 + ring >= _claimed_max_x &&
+                y0 - ring <= _claimed_min_y && y0 + ring >= _claimed_max_y)
+                break;
+        }
+
+        std::sort_heap(result.begin(), result.end(), closer);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Callback, typename BoundsFunction>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_potential_pair(
+        Callback &&callback,
+        BoundsFunction &&bounds_fn) const
+    {
+        std::vector<PairCandidate> candidates;
+
+        for (size_t i = 0; i < _hash_table.size(); i++)
+        {
+            const BucketHeader &head = header(i);
+            if (head.last_claimed == _current_round && !for_each_pair_in_bucket(head.x, head.y, _hash_table[i], candidates, callback, bounds_fn))
+                return false;
+        }
+
+        for (const auto &entry : _overflow)
+        {
+            if (!for_each_pair_in_bucket(entry.first.x, entry.first.y, entry.second, candidates, callback, bounds_fn))
+                return false;
+        }
+
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename BoundsFunction>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_potential_pairs(
+        std::vector<std::vector<std::pair<Value, Value>>> &result,
+        BoundsFunction &&bounds_fn,
+        unsigned int threads) const
+    {
+        threads = std::max(threads, 1u);
+        result.resize(threads);
+
+        detail::parallel_for(threads, _hash_table.size(), [&](unsigned int thread, size_t begin, size_t end) {
+            std::vector<std::pair<Value, Value>> &pairs = result[thread];
+            std::vector<PairCandidate> candidates;
+            auto callback = [&pairs](const Value &a, const Value &b) { pairs.emplace_back(a, b); };
+
+            pairs.clear();
+
+            for (size_t i = begin; i < end; i++)
+            {
+                const BucketHeader &head = header(i);
+                if (head.last_claimed == _current_round)
+                    for_each_pair_in_bucket(head.x, head.y, _hash_table[i], candidates, callback, bounds_fn);
+            }
+
+            if (thread == threads - 1)
+            {
+                for (const auto &entry : _overflow)
+                    for_each_pair_in_bucket(entry.first.x, entry.first.y, entry.second, candidates, callback, bounds_fn);
+            }
+        });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Callback, typename BoundsFunction>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_pair_in_bucket(
+        int x,
+        int y,
+        const HashBucket &bucket,
+        std::vector<PairCandidate> &candidates,
+        Callback &callback,
+        BoundsFunction &bounds_fn) const
+    {
+        candidates.clear();
+
+        for (const Value &value : _store.range(bucket.data))
+        {
+            Bounds bounds = bounds_fn(value);
+            candidates.push_back({&value, cell(bounds.top_left_x), cell(bounds.top_left_y)});
+        }
+
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            for (size_t j = i + 1; j < candidates.size(); j++)
+            {
+                // canonical cell of the pair
+                if (std::max(candidates[i].x, candidates[j].x) != x ||
+                    std::max(candidates[i].y, candidates[j].y) != y)
+                    continue;
+
+                if (!detail::visit(callback, *candidates[i].value, *candidates[j].value))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::BucketRange
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::range_at_cell(int x, int y, int salt) const
+    {
+        static const typename Store::Bucket empty;
+
+        const HashBucket *bucket = find_bucket(x, y, salt);
+        return _store.range(bucket == nullptr ? empty : bucket->data);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::BucketRange
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::range_at_point(real x, real y, int salt) const
+    {
+        return range_at_cell(cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    int SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::cell(real coordinate) const
+    {
+        return _coordinates.cell(coordinate);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    double SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::to_cells(real coordinate) const
+    {
+        return coordinate * _coordinates.scale();
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::get_bucket(int x, int y, int salt)
+    {
+        return get_bucket(x, y, salt, key_hash(x, y, salt));
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::extend_claimed_bounds(int x, int y)
+    {
+        _claimed_min_x = std::min(_claimed_min_x, x);
+        _claimed_min_y = std::min(_claimed_min_y, y);
+        _claimed_max_x = std::max(_claimed_max_x, x);
+        _claimed_max_y = std::max(_claimed_max_y, y);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::get_bucket(int x, int y, int salt, HashValue hash)
+    {
+        return Table::get_bucket({x, y, salt}, hash, [this](const CellKey &key) {
+            extend_claimed_bounds(key.x, key.y);
+        });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    const typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::find_bucket(int x, int y, int salt) const
+    {
+        return find_bucket(x, y, salt, key_hash(x, y, salt));
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    const typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *
+    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::find_bucket(int x, int y, int salt, HashValue hash) const
+    {
+        return Table::find_bucket({x, y, salt}, hash);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    HashValue SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::key_hash(int x, int y, int salt) const
+    {
+        return Table::key_hash({x, y, salt});
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::key_hash_row(int x, int y, int salt, HashValue *hashes, size_t count) const
+    {
+        if constexpr (detail::has_hash_row<HashFunction>::value)
+        {
+            HashFunction::hash_row(x, y, salt, _current_round + 1, hashes, count);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                hashes[i] = key_hash(x + (int)i, y, salt);
+        }
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename CellVisitor>
+    bool SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_hashed_cell_in_aabb(int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt, CellVisitor &&cell_visitor) const
+    {
+        HashValue hashes[ROW_BATCH];
+
+        for (int j = top_left_y; j <= bottom_right_y; j++)
+        {
+            for (int i = top_left_x; i <= bottom_right_x; i += ROW_BATCH)
+            {
+                int count = std::min(ROW_BATCH, bottom_right_x - i + 1);
+                key_hash_row(i, j, salt, hashes, count);
+
+                for (int k = 0; k < count; k++)
+                {
+                    if (!cell_visitor(i + k, j, hashes[k]))
+                        return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // SpatialHash whose insert_* may be called from any number of threads at once, queries not alongside inserts
+    template <typename Value, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, size_t BUCKET_CAPACITY = 8, typename Coordinates = coordinates::Scaled<>>
+    class ConcurrentSpatialHash
+    {
+        static constexpr size_t CHUNK_CAPACITY = 4 * BUCKET_CAPACITY;
+
+    public:
+        using real = typename Coordinates::real;
+
+        struct Chunk
+        {
+            std::atomic<uint32_t> size{0};
+            Chunk *next = nullptr;
+            Value values[CHUNK_CAPACITY];
+        };
+
+        struct HashBucket
+        {
+            int x;
+            int y;
+            int salt;
+            std::atomic<unsigned int> last_claimed{(unsigned int)-1};
+            std::atomic<unsigned int> last_published{(unsigned int)-1}; // round for which x and y are valid
+            std::atomic<uint32_t> size{0};
+            std::atomic<Chunk *> spill{nullptr}; // values beyond BUCKET_CAPACITY, newest chunk first
+        };
+
+        ConcurrentSpatialHash();
+        ~ConcurrentSpatialHash();
+
+        ConcurrentSpatialHash(
+            real cell_size,
+            unsigned int table_size);
+
+        // not thread safe
+        void reset(real cell_size, unsigned int table_size);
+
+        void insert_at_cell(
+            int x,
+            int y,
+            const Value &value,
+            int salt = 0);
+
+        void insert_at_point(
+            real x,
+            real y,
+            const Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            const Value &value,
+            int salt = 0);
+
+        void insert_at_segment(
+            real start_x_coord,
+            real start_y_coord,
+            real end_x_coord,
+            real end_y_coord,
+            const Value &value,
+            int salt = 0);
+
+        void query_at_cell(
+            std::vector<Value> &result,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_cell(
+            Visitor &&visitor,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        // number of inserts since the last reset that found every probe claimed by other cells and went to the
+        // overflow stash
+        size_t overflows() const;
+
+        int cell(real coordinate) const;
+
+        // continuous coordinate in cell units
+        double to_cells(real coordinate) const;
+
+    private:
+        // block b of the arena holds FIRST_BLOCK << b chunks, a missing block is installed with a CAS
+        static constexpr size_t FIRST_BLOCK = 64;
+        static constexpr size_t BLOCKS = 32;
+
+        struct CellKey
+        {
+            int x;
+            int y;
+            int salt;
+
+            inline bool operator==(const CellKey &other) const
+            {
+                return x == other.x && y == other.y && salt == other.salt;
+            }
+        };
+
+        struct CellKeyHash
+        {
+            inline size_t operator()(const CellKey &key) const
+            {
+                return HashFunction::hash(key.x, key.y, key.salt, 0);
+            }
+        };
+
+        HashValue key_hash(int x, int y, int salt) const;
+
+        // spins while another thread is between claiming the bucket and publishing its cell
+        bool owns_cell(HashBucket &bucket, int x, int y, int salt);
+
+        void push_spill(HashBucket &bucket, const Value &value);
+        Chunk *allocate_chunk();
+
+    private:
+        Coordinates _coordinates;
+        unsigned int _table_size;
+        unsigned int _current_round = 0; // pepper
+
+        std::unique_ptr<HashBucket[]> _hash_table;
+        std::vector<Value> _values;
+
+        std::array<std::atomic<Chunk *>, BLOCKS> _blocks{};
+        std::atomic<size_t> _chunks_used{0};
+
+        std::mutex _overflow_lock;
+        std::unordered_map<CellKey, std::vector<Value>, CellKeyHash> _overflow;
+        std::atomic<size_t> _overflows{0};
+    };
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::ConcurrentSpatialHash()
+        : ConcurrentSpatialHash(1, 1024)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::ConcurrentSpatialHash(
+        real cell_size,
+        unsigned int table_size)
+        : _coordinates(cell_size),
+          _table_size(table_size),
+          _hash_table(new HashBucket[table_size]),
+          _values((size_t)table_size * BUCKET_CAPACITY)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::~ConcurrentSpatialHash()
+    {
+        for (auto &block : _blocks)
+            delete[] block.load(std::memory_order_relaxed);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::reset(real cell_size, unsigned int table_size)
+    {
+        _coordinates.set_cell_size(cell_size);
+        _current_round += 1;
+        _chunks_used = 0;
+        _overflow.clear();
+        _overflows = 0;
+
+        // the round counter wrapped onto the never claimed marker, start over with fresh buckets
+        bool wrapped = _current_round == (unsigned int)-1;
+        if (wrapped)
+            _current_round = 0;
+
+        if (_table_size != table_size || wrapped)
+        {
+            _table_size = table_size;
+            _hash_table.reset(new HashBucket[_table_size]);
+            _values.resize((size_t)_table_size * BUCKET_CAPACITY);
+        }
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::insert_at_cell(
+        int x,
+        int y,
+        const Value &value,
+        int salt)
+    {
+        HashValue hash = key_hash(x, y, salt);
+
+        for (size_t i = 0; i <= REHASH_ROUNDS; i++)
+        {
+            HashValue index = ReduceFunction::reduce(detail::probe_hash(hash, i), _table_size);
+            HashBucket &bucket = _hash_table[index];
+
+            if (!owns_cell(bucket, x, y, salt))
+                continue;
+
+            uint32_t slot = bucket.size.fetch_add(1, std::memory_order_relaxed);
+            if (slot < BUCKET_CAPACITY)
+                _values[(size_t)index * BUCKET_CAPACITY + slot] = value;
+            else
+                push_spill(bucket, value);
+            return;
+        }
+
+        _overflows.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> guard(_overflow_lock);
+        _overflow[{x, y, salt}].push_back(value);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::insert_at_point(
+        real x,
+        real y,
+        const Value &value,
+        int salt)
+    {
+        insert_at_cell(cell(x), cell(y), value, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        const Value &value,
+        int salt)
+    {
+        detail::for_each_cell_in_aabb(
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y),
+            [&](int x, int y) {
+                insert_at_cell(x, y, value, salt);
+                return true;
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::insert_at_segment(
+        real start_x_coord,
+        real start_y_coord,
+        real end_x_coord,
+        real end_y_coord,
+        const Value &value,
+        int salt)
+    {
+        double x0 = to_cells(start_x_coord);
+        double y0 = to_cells(start_y_coord);
+
+        detail::for_each_cell_on_ray(
+            x0, y0, to_cells(end_x_coord) - x0, to_cells(end_y_coord) - y0, 1.0,
+            [&](int x, int y, double, double) {
+                insert_at_cell(x, y, value, salt);
+                return true;
+            });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::query_at_cell(
+        std::vector<Value> &result,
+        int x,
+        int y,
+        int salt) const
+    {
+        for_each_at_cell([&result](const Value &value) { result.push_back(value); }, x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::query_at_point(
+        std::vector<Value> &result,
+        real x,
+        real y,
+        int salt) const
+    {
+        query_at_cell(result, cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_at_aabb(
+            [&result](const Value &value) { result.push_back(value); },
+            top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    template <typename Visitor>
+    bool ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::for_each_at_cell(
+        Visitor &&visitor,
+        int x,
+        int y,
+        int salt) const
+    {
+        HashValue hash = key_hash(x, y, salt);
+
+        for (size_t i = 0; i <= REHASH_ROUNDS; i++)
+        {
+            HashValue index = ReduceFunction::reduce(detail::probe_hash(hash, i), _table_size);
+            const HashBucket &bucket = _hash_table[index];
+
+            if (bucket.last_published.load(std::memory_order_acquire) != _current_round)
+                return true;
+
+            if (bucket.x != x || bucket.y != y || bucket.salt != salt)
+                continue;
+
+            uint32_t size = bucket.size.load(std::memory_order_relaxed);
+            const Value *values = &_values[(size_t)index * BUCKET_CAPACITY];
+
+            for (uint32_t slot = 0; slot < std::min<uint32_t>(size, BUCKET_CAPACITY); slot++)
+            {
+                if (!detail::visit(visitor, values[slot]))
+                    return false;
+            }
+
+            for (const Chunk *chunk = bucket.spill.load(std::memory_order_acquire); chunk != nullptr; chunk = chunk->next)
+            {
+                uint32_t chunk_size = std::min<uint32_t>(chunk->size.load(std::memory_order_relaxed), CHUNK_CAPACITY);
+                for (uint32_t slot = 0; slot < chunk_size; slot++)
+                {
+                    if (!detail::visit(visitor, chunk->values[slot]))
+                        return false;
+                }
+            }
+
+            return true;
+        }
+
+        // every probe belongs to another cell, the cell is either in the stash or nowhere
+        if (_overflow.empty())
+            return true;
+
+        auto found = _overflow.find({x, y, salt});
+        if (found == _overflow.end())
+            return true;
+
+        for (const Value &value : found->second)
+        {
+            if (!detail::visit(visitor, value))
+                return false;
+        }
+
+        return true;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    template <typename Visitor>
+    bool ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::for_each_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        int salt) const
+    {
+        return for_each_at_cell(visitor, cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    template <typename Visitor>
+    bool ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        return detail::for_each_cell_in_aabb(
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y),
+            [&](int x, int y) { return for_each_at_cell(visitor, x, y, salt); });
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    size_t ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::overflows() const
+    {
+        return _overflows.load(std::memory_order_relaxed);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    int ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::cell(real coordinate) const
+    {
+        return _coordinates.cell(coordinate);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    double ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::to_cells(real coordinate) const
+    {
+        return coordinate * _coordinates.scale();
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    HashValue ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::key_hash(int x, int y, int salt) const
+    {
+        return HashFunction::hash(x, y, salt, _current_round + 1);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    bool ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::owns_cell(HashBucket &bucket, int x, int y, int salt)
+    {
+        unsigned int claimed = bucket.last_claimed.load(std::memory_order_relaxed);
+
+        if (claimed != _current_round &&
+            bucket.last_claimed.compare_exchange_strong(claimed, _current_round, std::memory_order_acq_rel))
+        {
+            bucket.x = x;
+            bucket.y = y;
+            bucket.salt = salt;
+            bucket.size.store(0, std::memory_order_relaxed);
+            bucket.spill.store(nullptr, std::memory_order_relaxed);
+            bucket.last_published.store(_current_round, std::memory_order_release);
+            return true;
+        }
+
+        while (bucket.last_published.load(std::memory_order_acquire) != _current_round)
+            std::this_thread::yield();
+
+        return bucket.x == x && bucket.y == y && bucket.salt == salt;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    void ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::push_spill(HashBucket &bucket, const Value &value)
+    {
+        Chunk *head = bucket.spill.load(std::memory_order_acquire);
+        Chunk *fresh = nullptr;
+
+        for (;;)
+        {
+            if (head != nullptr)
+            {
+                uint32_t slot = head->size.fetch_add(1, std::memory_order_relaxed);
+                if (slot < CHUNK_CAPACITY)
+                {
+                    head->values[slot] = value;
+                    return;
+                }
+            }
+
+            // the head is full, a chunk that lost the race to become the head is kept for the next attempt
+            if (fresh == nullptr)
+                fresh = allocate_chunk();
+
+            fresh->values[0] = value;
+            fresh->size.store(1, std::memory_order_relaxed);
+            fresh->next = head;
+
+            if (bucket.spill.compare_exchange_weak(head, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+                return;
+        }
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, size_t BUCKET_CAPACITY, typename Coordinates>
+    typename ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::Chunk *ConcurrentSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, BUCKET_CAPACITY, Coordinates>::allocate_chunk()
+    {
+        size_t index = _chunks_used.fetch_add(1, std::memory_order_relaxed);
+
+        size_t block = 0;
+        size_t block_begin = 0;
+        while (index >= block_begin + (FIRST_BLOCK << block))
+        {
+            block_begin += FIRST_BLOCK << block;
+            block++;
+        }
+
+        Chunk *chunks = _blocks[block].load(std::memory_order_acquire);
+        if (chunks == nullptr)
+        {
+            Chunk *allocated = new Chunk[FIRST_BLOCK << block];
+            if (_blocks[block].compare_exchange_strong(chunks, allocated, std::memory_order_acq_rel))
+                chunks = allocated;
+            else
+                delete[] allocated;
+        }
+
+        Chunk *chunk = &chunks[index - block_begin];
+        chunk->size.store(0, std::memory_order_relaxed);
+        chunk->next = nullptr;
+        return chunk;
+    }
+
+    // LEVELS cell sizes of cell_size * 2^l in one SpatialHash, salts must stay within INT_MAX / LEVELS
+    template <typename Value, size_t LEVELS = 8, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>>
+    class HierarchicalSpatialHash
+    {
+        static_assert(LEVELS > 0 && LEVELS <= 32, "the levels in use are tracked in a 32 bit mask");
+
+    public:
+        using Hash = SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>;
+        using real = typename Hash::real;
+
+        HierarchicalSpatialHash();
+
+        // cell_size is the cell size of the finest level
+        HierarchicalSpatialHash(
+            real cell_size,
+            unsigned int table_size,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        void reset(real cell_size, unsigned int table_size);
+
+        // finest level at which the aabb covers at most 2 x 2 cells, the coarsest level if there is none
+        int level_of(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y) const;
+
+        // a point always goes into the finest level
+        void insert_at_point(
+            real x,
+            real y,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            Value &value,
+            int salt = 0);
+
+        bool remove_at_point(
+            real x,
+            real y,
+            const Value &value,
+            int salt = 0);
+
+        bool remove_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            const Value &value,
+            int salt = 0);
+
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        // like SpatialHash::query_at_aabb a value covering several of the walked cells is reported once per cell
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        // bit l is set if level l holds anything in the current round
+        uint32_t levels_in_use() const;
+
+        const Hash &hash() const;
+
+    private:
+        static int level_salt(int salt, int level);
+
+        // walks the cells of the inclusive rectangle of finest cells at every level in use
+        template <typename Visitor>
+        bool for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt) const;
+
+        Hash _hash;
+        uint32_t _levels_in_use = 0;
+    };
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::HierarchicalSpatialHash()
+        : HierarchicalSpatialHash(1, 1024)
+    {
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::HierarchicalSpatialHash(
+        real cell_size,
+        unsigned int table_size,
+        std::pmr::memory_resource *resource)
+        : _hash(cell_size, table_size, resource)
+    {
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::reset(real cell_size, unsigned int table_size)
+    {
+        _hash.reset(cell_size, table_size);
+        _levels_in_use = 0;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    int HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::level_of(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y) const
+    {
+        int top_left_cell_x = _hash.cell(top_left_x);
+        int top_left_cell_y = _hash.cell(top_left_y);
+        int bottom_right_cell_x = _hash.cell(bottom_right_x);
+        int bottom_right_cell_y = _hash.cell(bottom_right_y);
+
+        for (int level = 0; level < (int)LEVELS - 1; level++)
+        {
+            if ((bottom_right_cell_x >> level) - (top_left_cell_x >> level) <= 1 &&
+                (bottom_right_cell_y >> level) - (top_left_cell_y >> level) <= 1)
+                return level;
+        }
+
+        return (int)LEVELS - 1;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_point(
+        real x,
+        real y,
+        Value &value,
+        int salt)
+    {
+        _hash.insert_at_cell(_hash.cell(x), _hash.cell(y), value, level_salt(salt, 0));
+        _levels_in_use |= 1u;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        Value &value,
+        int salt)
+    {
+        int level = level_of(top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+        int level_salt_of_value = level_salt(salt, level);
+
+        detail::for_each_cell_in_aabb(
+            _hash.cell(top_left_x) >> level, _hash.cell(top_left_y) >> level,
+            _hash.cell(bottom_right_x) >> level, _hash.cell(bottom_right_y) >> level,
+            [&](int x, int y) {
+                _hash.insert_at_cell(x, y, value, level_salt_of_value);
+                return true;
+            });
+
+        _levels_in_use |= 1u << level;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    bool HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::remove_at_point(
+        real x,
+        real y,
+        const Value &value,
+        int salt)
+    {
+        return _hash.remove_at_cell(_hash.cell(x), _hash.cell(y), value, level_salt(salt, 0));
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    bool HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::remove_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        const Value &value,
+        int salt)
+    {
+        int level = level_of(top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+        int level_salt_of_value = level_salt(salt, level);
+        bool removed = true;
+
+        detail::for_each_cell_in_aabb(
+            _hash.cell(top_left_x) >> level, _hash.cell(top_left_y) >> level,
+            _hash.cell(bottom_right_x) >> level, _hash.cell(bottom_right_y) >> level,
+            [&](int x, int y) {
+                removed &= _hash.remove_at_cell(x, y, value, level_salt_of_value);
+                return true;
+            });
+
+        return removed;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_point(
+        std::vector<Value> &result,
+        real x,
+        real y,
+        int salt) const
+    {
+        int cell_x = _hash.cell(x);
+        int cell_y = _hash.cell(y);
+
+        for_each_span_at_cells(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            cell_x, cell_y, cell_x, cell_y, salt);
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_span_at_cells(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            _hash.cell(top_left_x), _hash.cell(top_left_y), _hash.cell(bottom_right_x), _hash.cell(bottom_right_y), salt);
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        int salt) const
+    {
+        return for_each_at_aabb(visitor, x, y, x, y, salt);
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        return for_each_span_at_cells(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            _hash.cell(top_left_x), _hash.cell(top_left_y), _hash.cell(bottom_right_x), _hash.cell(bottom_right_y), salt);
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    uint32_t HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::levels_in_use() const
+    {
+        return _levels_in_use;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    const typename HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::Hash &HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::hash() const
+    {
+        return _hash;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    int HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::level_salt(int salt, int level)
+    {
+        return salt * (int)LEVELS + level;
+    }
+
+    template <typename Value, size_t LEVELS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool HierarchicalSpatialHash<Value, LEVELS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt) const
+    {
+        for (int level = 0; level < (int)LEVELS; level++)
+        {
+            if ((_levels_in_use & (1u << level)) == 0)
+                continue;
+
+            int level_salt_of_query = level_salt(salt, level);
+
+            bool completed = detail::for_each_cell_in_aabb(
+                top_left_x >> level, top_left_y >> level, bottom_right_x >> level, bottom_right_y >> level,
+                [&](int x, int y) {
+                    return _hash.for_each_span_at_cell(visitor, x, y, level_salt_of_query);
+                });
+
+            if (!completed)
+                return false;
+        }
+
+        return true;
+    }
+
+    // SpatialHash over DIMENSIONS dimensional cells, points and boxes take one coordinate per axis
+    template <typename Value, size_t DIMENSIONS = 3, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>, typename Statistics = statistics::None>
+    class SpatialHashN : public detail::BucketTable<detail::VolumeCell<HashFunction, DIMENSIONS>, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>
+    {
+        static_assert(DIMENSIONS >= 2, "use SpatialHash with a constant y for a line");
+
+        using Table = detail::BucketTable<detail::VolumeCell<HashFunction, DIMENSIONS>, Value, ReduceFunction, REHASH_ROUNDS, Storage, Statistics>;
+
+    public:
+        using real = typename Coordinates::real;
+        using Store = typename Table::Store;
+        using BucketHeader = typename Table::BucketHeader;
+        using HashBucket = typename Table::HashBucket;
+        using Stats = typename Table::Stats;
+        using Cell = std::array<int, DIMENSIONS>;
+        using Point = std::array<real, DIMENSIONS>;
+
+        struct Key
+        {
+            Point point;
+            int salt = 0;
+        };
+
+        SpatialHashN();
+
+        SpatialHashN(
+            real cell_size,
+            unsigned int table_size,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        void reset(real cell_size, unsigned int table_size);
+
+        void insert_at_cell(
+            const Cell &cell,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_point(
+            const Point &point,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            const Point &min_corner,
+            const Point &max_corner,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_segment(
+            const Point &start,
+            const Point &end,
+            Value &value,
+            int salt = 0);
+
+        bool remove_at_cell(
+            const Cell &cell,
+            const Value &value,
+            int salt = 0);
+
+        bool remove_at_point(
+            const Point &point,
+            const Value &value,
+            int salt = 0);
+
+        bool remove_at_aabb(
+            const Point &min_corner,
+            const Point &max_corner,
+            const Value &value,
+            int salt = 0);
+
+        void query_at_cell(
+            std::vector<Value> &result,
+            const Cell &cell,
+            int salt = 0) const;
+
+        void query_at_point(
+            std::vector<Value> &result,
+            const Point &point,
+            int salt = 0) const;
+
+        void query_at_aabb(
+            std::vector<Value> &result,
+            const Point &min_corner,
+            const Point &max_corner,
+            int salt = 0) const;
+
+        void query_at_segment(
+            std::vector<Value> &result,
+            const Point &start,
+            const Point &end,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_span_at_cell(
+            Visitor &&visitor,
+            const Cell &cell,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_cell(
+            Visitor &&visitor,
+            const Cell &cell,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            const Point &point,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            const Point &min_corner,
+            const Point &max_corner,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_segment(
+            Visitor &&visitor,
+            const Point &start,
+            const Point &end,
+            int salt = 0) const;
+
+        // point inserts and queries for many keys at once, key_fn(item) returns the Key of every item of [first, last)
+        // hashed and prefetched a batch ahead like the ones of SpatialHash
+        template <typename Iterator, typename KeyFunction>
+        void insert_batch(
+            Iterator first,
+            Iterator last,
+            KeyFunction &&key_fn);
+
+        // calls output_fn(index, first, last) for every span found, returns false if output_fn stopped the batch
+        template <typename Iterator, typename KeyFunction, typename Output>
+        bool query_batch(
+            Iterator first,
+            Iterator last,
+            KeyFunction &&key_fn,
+            Output &&output_fn) const;
+
+        //private:
+        Cell cell(const Point &point) const;
+        HashBucket *get_bucket(const Cell &cell, int salt);
+        const HashBucket *find_bucket(const Cell &cell, int salt) const;
+
+    private:
+        using CellKey = detail::VolumeCell<HashFunction, DIMENSIONS>;
+
+        using Table::_store;
+
+        // calls cell_visitor(cell) for every cell the segment passes through
+        template <typename CellVisitor>
+        bool for_each_cell_on_segment(const Point &start, const Point &end, CellVisitor &&cell_visitor) const;
+
+        Coordinates _coordinates;
+    };
+
+    template <typename Value, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>, typename Statistics = statistics::None>
+    using SpatialHash3D = SpatialHashN<Value, 3, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>;
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::SpatialHashN()
+        : SpatialHashN(1, 1024)
+    {
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::SpatialHashN(
+        real cell_size,
+        unsigned int table_size,
+        std::pmr::memory_resource *resource)
+        : Table(table_size, resource),
+          _coordinates(cell_size)
+    {
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::reset(real cell_size, unsigned int table_size)
+    {
+        _coordinates.set_cell_size(cell_size);
+        Table::next_round(table_size);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_cell(
+        const Cell &cell,
+        Value &value,
+        int salt)
+    {
+        _store.push_back(get_bucket(cell, salt)->data, value);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_point(
+        const Point &point,
+        Value &value,
+        int salt)
+    {
+        insert_at_cell(cell(point), value, salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_aabb(
+        const Point &min_corner,
+        const Point &max_corner,
+        Value &value,
+        int salt)
+    {
+        detail::for_each_cell_in_box<DIMENSIONS>(cell(min_corner), cell(max_corner), [&](const Cell &cell) {
+            insert_at_cell(cell, value, salt);
+            return true;
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_at_segment(
+        const Point &start,
+        const Point &end,
+        Value &value,
+        int salt)
+    {
+        for_each_cell_on_segment(start, end, [&](const Cell &cell) {
+            insert_at_cell(cell, value, salt);
+            return true;
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_cell(
+        const Cell &cell,
+        const Value &value,
+        int salt)
+    {
+        HashBucket *bucket = const_cast<HashBucket *>(find_bucket(cell, salt));
+        if (bucket == nullptr)
+            return false;
+
+        return _store.erase(bucket->data, value);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_point(
+        const Point &point,
+        const Value &value,
+        int salt)
+    {
+        return remove_at_cell(cell(point), value, salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::remove_at_aabb(
+        const Point &min_corner,
+        const Point &max_corner,
+        const Value &value,
+        int salt)
+    {
+        bool removed = true;
+
+        detail::for_each_cell_in_box<DIMENSIONS>(cell(min_corner), cell(max_corner), [&](const Cell &cell) {
+            removed &= remove_at_cell(cell, value, salt);
+            return true;
+        });
+
+        return removed;
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_cell(
+        std::vector<Value> &result,
+        const Cell &cell,
+        int salt) const
+    {
+        for_each_span_at_cell([&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); }, cell, salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_point(
+        std::vector<Value> &result,
+        const Point &point,
+        int salt) const
+    {
+        query_at_cell(result, cell(point), salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_aabb(
+        std::vector<Value> &result,
+        const Point &min_corner,
+        const Point &max_corner,
+        int salt) const
+    {
+        detail::for_each_cell_in_box<DIMENSIONS>(cell(min_corner), cell(max_corner), [&](const Cell &cell) {
+            query_at_cell(result, cell, salt);
+            return true;
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_at_segment(
+        std::vector<Value> &result,
+        const Point &start,
+        const Point &end,
+        int salt) const
+    {
+        for_each_cell_on_segment(start, end, [&](const Cell &cell) {
+            query_at_cell(result, cell, salt);
+            return true;
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_span_at_cell(
+        Visitor &&visitor,
+        const Cell &cell,
+        int salt) const
+    {
+        const HashBucket *bucket = find_bucket(cell, salt);
+        if (bucket == nullptr)
+            return true;
+
+        return _store.for_each_span(bucket->data, [&visitor](const Value *first, const Value *last) {
+            return detail::visit(visitor, first, last);
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_cell(
+        Visitor &&visitor,
+        const Cell &cell,
+        int salt) const
+    {
+        return for_each_span_at_cell(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            cell, salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_point(
+        Visitor &&visitor,
+        const Point &point,
+        int salt) const
+    {
+        return for_each_at_cell(visitor, cell(point), salt);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_aabb(
+        Visitor &&visitor,
+        const Point &min_corner,
+        const Point &max_corner,
+        int salt) const
+    {
+        return detail::for_each_cell_in_box<DIMENSIONS>(cell(min_corner), cell(max_corner), [&](const Cell &cell) {
+            return for_each_at_cell(visitor, cell, salt);
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Visitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_at_segment(
+        Visitor &&visitor,
+        const Point &start,
+        const Point &end,
+        int salt) const
+    {
+        return for_each_cell_on_segment(start, end, [&](const Cell &cell) {
+            return for_each_at_cell(visitor, cell, salt);
+        });
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Iterator, typename KeyFunction>
+    void SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::insert_batch(
+        Iterator first,
+        Iterator last,
+        KeyFunction &&key_fn)
+    {
+        Table::insert_batch_cells(
+            first, last,
+            [this, &key_fn](auto &&item) {
+                Key key = key_fn(item);
+                return CellKey{cell(key.point), key.salt};
+            },
+            [](const CellKey &) {});
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename Iterator, typename KeyFunction, typename Output>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::query_batch(
+        Iterator first,
+        Iterator last,
+        KeyFunction &&key_fn,
+        Output &&output_fn) const
+    {
+        return Table::query_batch_cells(
+            first, last,
+            [this, &key_fn](auto &&item) {
+                Key key = key_fn(item);
+                return CellKey{cell(key.point), key.salt};
+            },
+            output_fn);
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::Cell SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::cell(const Point &point) const
+    {
+        Cell cell;
+
+        for (size_t axis = 0; axis < DIMENSIONS; axis++)
+            cell[axis] = _coordinates.cell(point[axis]);
+
+        return cell;
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    typename SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::get_bucket(const Cell &cell, int salt)
+    {
+        CellKey key{cell, salt};
+        return Table::get_bucket(key, Table::key_hash(key), [](const CellKey &) {});
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    const typename SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::HashBucket *SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::find_bucket(const Cell &cell, int salt) const
+    {
+        CellKey key{cell, salt};
+        return Table::find_bucket(key, Table::key_hash(key));
+    }
+
+    template <typename Value, size_t DIMENSIONS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates, typename Statistics>
+    template <typename CellVisitor>
+    bool SpatialHashN<Value, DIMENSIONS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates, Statistics>::for_each_cell_on_segment(const Point &start, const Point &end, CellVisitor &&cell_visitor) const
+    {
+        std::array<double, DIMENSIONS> origin;
+        std::array<double, DIMENSIONS> direction;
+
+        for (size_t axis = 0; axis < DIMENSIONS; axis++)
+        {
+            origin[axis] = start[axis] * _coordinates.scale();
+            direction[axis] = end[axis] * _coordinates.scale() - origin[axis];
+        }
+
+        return detail::for_each_cell_on_ray<DIMENSIONS>(origin, direction, 1.0, [&](const Cell &cell, double, double) {
+            return cell_visitor(cell);
+        });
+    }
+
+    // one SpatialHash per layer sharing the cell size, queries take a bitmask of layers
+    template <typename Value, size_t LAYERS, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>>
+    class LayeredSpatialHash
+    {
+        static_assert(LAYERS > 0 && LAYERS <= 32, "layers are selected by a 32 bit mask");
+
+    public:
+        using Hash = SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>;
+        using real = typename Hash::real;
+        using TableSizes = std::array<unsigned int, LAYERS>;
+
+        static constexpr uint32_t ALL_LAYERS = LAYERS == 32 ? ~0u : (1u << LAYERS) - 1;
+
+        LayeredSpatialHash(
+            real cell_size,
+            const TableSizes &table_sizes,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        // keeps the table size of every layer
+        void reset(real cell_size);
+        void reset(real cell_size, const TableSizes &table_sizes);
+
+        Hash &layer(size_t layer);
+        const Hash &layer(size_t layer) const;
+
+        void insert_at_point(
+            real x,
+            real y,
+            Value &value,
+            size_t layer);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            Value &value,
+            size_t layer);
+
+        bool remove_at_point(
+            real x,
+            real y,
+            const Value &value,
+            size_t layer);
+
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            uint32_t layers = ALL_LAYERS) const;
+
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            uint32_t layers = ALL_LAYERS) const;
+
+        // visitor(layer, value), returning false from it stops the walk
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            uint32_t layers = ALL_LAYERS) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            uint32_t layers = ALL_LAYERS) const;
+
+    private:
+        // visitor(layer, first, last) for the spans of every masked layer at every cell of the inclusive rectangle
+        template <typename Visitor>
+        bool for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, uint32_t layers) const;
+
+        std::array<std::unique_ptr<Hash>, LAYERS> _layers;
+    };
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::LayeredSpatialHash(
+        real cell_size,
+        const TableSizes &table_sizes,
+        std::pmr::memory_resource *resource)
+    {
+        for (size_t layer = 0; layer < LAYERS; layer++)
+            _layers[layer] = std::make_unique<Hash>(cell_size, table_sizes[layer], resource);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::reset(real cell_size)
+    {
+        for (auto &layer : _layers)
+            layer->reset(cell_size, layer->table_size());
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::reset(real cell_size, const TableSizes &table_sizes)
+    {
+        for (size_t layer = 0; layer < LAYERS; layer++)
+            _layers[layer]->reset(cell_size, table_sizes[layer]);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    typename LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::Hash &LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::layer(size_t layer)
+    {
+        return *_layers[layer];
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    const typename LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::Hash &LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::layer(size_t layer) const
+    {
+        return *_layers[layer];
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_point(
+        real x,
+        real y,
+        Value &value,
+        size_t layer)
+    {
+        _layers[layer]->insert_at_point(x, y, value);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        Value &value,
+        size_t layer)
+    {
+        _layers[layer]->insert_at_aabb(top_left_x, top_left_y, bottom_right_x, bottom_right_y, value);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    bool LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::remove_at_point(
+        real x,
+        real y,
+        const Value &value,
+        size_t layer)
+    {
+        return _layers[layer]->remove_at_point(x, y, value);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_point(
+        std::vector<Value> &result,
+        real x,
+        real y,
+        uint32_t layers) const
+    {
+        query_at_aabb(result, x, y, x, y, layers);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        uint32_t layers) const
+    {
+        const Hash &first = *_layers.front();
+
+        for_each_span_at_cells(
+            [&result](size_t, const Value *span_first, const Value *span_last) { result.insert(result.end(), span_first, span_last); },
+            first.cell(top_left_x), first.cell(top_left_y), first.cell(bottom_right_x), first.cell(bottom_right_y), layers);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        uint32_t layers) const
+    {
+        return for_each_at_aabb(visitor, x, y, x, y, layers);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        uint32_t layers) const
+    {
+        const Hash &first = *_layers.front();
+
+        return for_each_span_at_cells(
+            [&visitor](size_t layer, const Value *span_first, const Value *span_last) {
+                for (const Value *value = span_first; value != span_last; value++)
+                {
+                    if (!detail::visit(visitor, layer, *value))
+                        return false;
+                }
+                return true;
+            },
+            first.cell(top_left_x), first.cell(top_left_y), first.cell(bottom_right_x), first.cell(bottom_right_y), layers);
+    }
+
+    template <typename Value, size_t LAYERS, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool LayeredSpatialHash<Value, LAYERS, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, uint32_t layers) const
+    {
+        layers &= ALL_LAYERS;
+
+        return detail::for_each_cell_in_aabb(top_left_x, top_left_y, bottom_right_x, bottom_right_y, [&](int x, int y) {
+            for (size_t layer = 0; layer < LAYERS; layer++)
+            {
+                if ((layers & (1u << layer)) == 0)
+                    continue;
+
+                bool completed = _layers[layer]->for_each_span_at_cell(
+                    [&visitor, layer](const Value *first, const Value *last) { return detail::visit(visitor, layer, first, last); },
+                    x, y);
+
+                if (!completed)
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    // immutable snapshot, inserts are staged and build() sorts them into Morton ordered cell ranges
+    template <typename Value, typename HashFunction = hashing::Murmur, typename Coordinates = coordinates::Scaled<>>
+    class FrozenSpatialHash
+    {
+    public:
+        using real = typename Coordinates::real;
+
+        // no padding, so that a saved snapshot only holds defined bytes
+        struct Cell
+        {
+            int x;
+            int y;
+            int salt;
+            uint32_t first;
+            uint32_t last;
+        };
+
+        // start of a saved snapshot, the sections follow at the given offsets, all in the byte order of the writer
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t value_size;
+            uint32_t hash_check;
+            double cell_size;
+            uint64_t cell_count;
+            uint64_t value_count;
+            uint64_t index_size;
+            uint64_t max_probes;
+            uint64_t cells_offset;
+            uint64_t values_offset;
+            uint64_t index_offset;
+        };
+
+        static constexpr uint32_t FILE_VERSION = 1;
+
+        // alignment attach requires of its data, the sections inside lie at multiples of 64 bytes
+        static constexpr size_t DATA_ALIGNMENT = std::max(alignof(FileHeader), alignof(Value));
+
+        FrozenSpatialHash();
+        explicit FrozenSpatialHash(real cell_size);
+
+        // a snapshot may point into its own vectors, copies would point into the ones of the original
+        FrozenSpatialHash(const FrozenSpatialHash &) = delete;
+        FrozenSpatialHash &operator=(const FrozenSpatialHash &) = delete;
+        FrozenSpatialHash(FrozenSpatialHash &&) = default;
+        FrozenSpatialHash &operator=(FrozenSpatialHash &&) = default;
+
+        // staged until the next build, at most 2^32 values in total
+        void insert_at_cell(
+            int x,
+            int y,
+            const Value &value,
+            int salt = 0);
+
+        void insert_at_point(
+            real x,
+            real y,
+            const Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            const Value &value,
+            int salt = 0);
+
+        // replaces the snapshot by the staged values, load is the share of used index slots, clamped to [1/64, 15/16]
+        void build(double load = 0.5);
+
+        void query_at_cell(
+            std::vector<Value> &result,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        // visitor(first, last) for the range of values of the cell, returning false from it stops the walk
+        template <typename Visitor>
+        bool for_each_span_at_cell(
+            Visitor &&visitor,
+            int x,
+            int y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_point(
+            Visitor &&visitor,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        // cells and values of the snapshot, and the longest probe of its index
+        size_t cells() const;
+        size_t size() const;
+        size_t max_probes() const;
+
+        // flat, versioned image of the snapshot, Value must be trivially copyable
+        size_t serialized_size() const;
+        void serialize(void *buffer) const;
+
+        // queries run over data in place, which must stay valid, be DATA_ALIGNMENT aligned and come from serialize
+        // returns false and keeps the current snapshot if the image does not check out
+        bool attach(const void *data, size_t size);
+
+#if defined(SHASH_FILE_IO)
+        bool save(const char *path) const;
+
+        // maps the file read only and attaches it, pages are only read once a query touches them
+        bool load(const char *path);
+#endif
+
+        //private:
+        int cell(real coordinate) const;
+        const Cell *find_cell(int x, int y, int salt) const;
+
+    private:
+        static constexpr uint32_t EMPTY = (uint32_t)-1;
+
+        struct Staged
+        {
+            uint64_t morton;
+            int x;
+            int y;
+            int salt;
+            Value value;
+        };
+
+        // what queries run over, the vectors of the last build or attached memory
+        struct Snapshot
+        {
+            const Cell *cells = nullptr;
+            size_t cell_count = 0;
+            const Value *values = nullptr;
+            size_t value_count = 0;
+            const uint32_t *index = nullptr;
+            size_t index_size = 0;
+            size_t max_probes = 0;
+        };
+
+        static constexpr size_t SECTION_ALIGNMENT = 64;
+        static_assert(alignof(Value) <= SECTION_ALIGNMENT, "values are placed at multiples of SECTION_ALIGNMENT");
+
+        static size_t align_section(size_t offset);
+        static uint32_t hash_check();
+
+        // count elements of element_size bytes starting at offset end inside size bytes, without overflowing
+        static bool section_fits(uint64_t offset, uint64_t count, size_t element_size, size_t size);
+
+        static size_t slot(int x, int y, int salt, size_t index_size);
+
+        template <typename Visitor>
+        bool for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt) const;
+
+        Coordinates _coordinates;
+        double _cell_size;
+        std::vector<Staged> _staged;
+
+        // sorted by salt and Morton code, the values of cell i are _values[first, last)
+        std::vector<Cell> _cells;
+        std::vector<Value> _values;
+
+        // open addressing with linear probing, a power of two of cell indices or EMPTY
+        std::vector<uint32_t> _index;
+
+        Snapshot _snapshot;
+
+        // keeps a loaded file mapped
+        std::shared_ptr<const void> _mapping;
+    };
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    FrozenSpatialHash<Value, HashFunction, Coordinates>::FrozenSpatialHash()
+        : FrozenSpatialHash(1)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    FrozenSpatialHash<Value, HashFunction, Coordinates>::FrozenSpatialHash(real cell_size)
+        : _coordinates(cell_size),
+          _cell_size(cell_size)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::insert_at_cell(
+        int x,
+        int y,
+        const Value &value,
+        int salt)
+    {
+        _staged.push_back({detail::morton_code(x, y), x, y, salt, value});
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::insert_at_point(
+        real x,
+        real y,
+        const Value &value,
+        int salt)
+    {
+        insert_at_cell(cell(x), cell(y), value, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        const Value &value,
+        int salt)
+    {
+        detail::for_each_cell_in_aabb(cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y), [&](int x, int y) {
+            insert_at_cell(x, y, value, salt);
+            return true;
+        });
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::build(double load)
+    {
+        std::stable_sort(_staged.begin(), _staged.end(), [](const Staged &a, const Staged &b) {
+            if (a.salt != b.salt)
+                return a.salt < b.salt;
+            if (a.morton != b.morton)
+                return a.morton < b.morton;
+            return false;
+        });
+
+        _cells.clear();
+        _values.clear();
+        _values.reserve(_staged.size());
+
+        for (const Staged &staged : _staged)
+        {
+            if (_cells.empty() || _cells.back().salt != staged.salt || _cells.back().x != staged.x || _cells.back().y != staged.y)
+                _cells.push_back({staged.x, staged.y, staged.salt, (uint32_t)_values.size(), (uint32_t)_values.size()});
+
+            _values.push_back(staged.value);
+            _cells.back().last += 1;
+        }
+
+        _staged.clear();
+        _staged.shrink_to_fit();
+
+        load = std::isnan(load) ? 0.5 : std::min(std::max(load, 1.0 / 64), 15.0 / 16);
+
+        size_t index_size = 1;
+        while (index_size * load < _cells.size() || index_size <= _cells.size())
+            index_size *= 2;
+
+        _index.assign(index_size, EMPTY);
+        size_t max_probes = 0;
+
+        for (uint32_t i = 0; i < _cells.size(); i++)
+        {
+            const Cell &cell = _cells[i];
+            size_t at = slot(cell.x, cell.y, cell.salt, index_size);
+            size_t probes = 1;
+
+            while (_index[at] != EMPTY)
+            {
+                at = (at + 1) & (index_size - 1);
+                probes++;
+            }
+
+            _index[at] = i;
+            max_probes = std::max(max_probes, probes);
+        }
+
+        _mapping.reset();
+        _snapshot = {_cells.data(), _cells.size(), _values.data(), _values.size(), _index.data(), _index.size(), max_probes};
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::query_at_cell(
+        std::vector<Value> &result,
+        int x,
+        int y,
+        int salt) const
+    {
+        for_each_span_at_cell([&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); }, x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::query_at_point(
+        std::vector<Value> &result,
+        real x,
+        real y,
+        int salt) const
+    {
+        query_at_cell(result, cell(x), cell(y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_span_at_cells(
+            [&result](const Value *first, const Value *last) { result.insert(result.end(), first, last); },
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    template <typename Visitor>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::for_each_span_at_cell(
+        Visitor &&visitor,
+        int x,
+        int y,
+        int salt) const
+    {
+        const Cell *found = find_cell(x, y, salt);
+        if (found == nullptr)
+            return true;
+
+        return detail::visit(visitor, _snapshot.values + found->first, _snapshot.values + found->last);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    template <typename Visitor>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::for_each_at_point(
+        Visitor &&visitor,
+        real x,
+        real y,
+        int salt) const
+    {
+        return for_each_at_aabb(visitor, x, y, x, y, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    template <typename Visitor>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        return for_each_span_at_cells(
+            [&visitor](const Value *first, const Value *last) {
+                for (const Value *value = first; value != last; value++)
+                {
+                    if (!detail::visit(visitor, *value))
+                        return false;
+                }
+                return true;
+            },
+            cell(top_left_x), cell(top_left_y), cell(bottom_right_x), cell(bottom_right_y), salt);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::cells() const
+    {
+        return _snapshot.cell_count;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::size() const
+    {
+        return _snapshot.value_count;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::max_probes() const
+    {
+        return _snapshot.max_probes;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::serialized_size() const
+    {
+        size_t cells_offset = align_section(sizeof(FileHeader));
+        size_t values_offset = align_section(cells_offset + _snapshot.cell_count * sizeof(Cell));
+        size_t index_offset = align_section(values_offset + _snapshot.value_count * sizeof(Value));
+        return index_offset + _snapshot.index_size * sizeof(uint32_t);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    void FrozenSpatialHash<Value, HashFunction, Coordinates>::serialize(void *buffer) const
+    {
+        static_assert(std::is_trivially_copyable<Value>::value, "only trivially copyable values can be saved");
+
+        FileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "SHASHFRZ", sizeof(header.magic));
+        header.version = FILE_VERSION;
+        header.byte_order = 0x01020304;
+        header.value_size = sizeof(Value);
+        header.hash_check = hash_check();
+        header.cell_size = _cell_size;
+        header.cell_count = _snapshot.cell_count;
+        header.value_count = _snapshot.value_count;
+        header.index_size = _snapshot.index_size;
+        header.max_probes = _snapshot.max_probes;
+        header.cells_offset = align_section(sizeof(FileHeader));
+        header.values_offset = align_section(header.cells_offset + header.cell_count * sizeof(Cell));
+        header.index_offset = align_section(header.values_offset + header.value_count * sizeof(Value));
+
+        char *bytes = static_cast<char *>(buffer);
+        std::memset(bytes, 0, serialized_size());
+        std::memcpy(bytes, &header, sizeof(header));
+
+        if (header.cell_count > 0)
+            std::memcpy(bytes + header.cells_offset, _snapshot.cells, header.cell_count * sizeof(Cell));
+        if (header.value_count > 0)
+            std::memcpy(bytes + header.values_offset, _snapshot.values, header.value_count * sizeof(Value));
+        if (header.index_size > 0)
+            std::memcpy(bytes + header.index_offset, _snapshot.index, header.index_size * sizeof(uint32_t));
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::attach(const void *data, size_t size)
+    {
+        static_assert(std::is_trivially_copyable<Value>::value, "only trivially copyable values can be attached");
+
+        FileHeader header;
+        if (size < sizeof(header) || (uintptr_t)data % DATA_ALIGNMENT != 0)
+            return false;
+
+        std::memcpy(&header, data, sizeof(header));
+
+        bool fits = std::memcmp(header.magic, "SHASHFRZ", sizeof(header.magic)) == 0 &&
+                    header.version == FILE_VERSION &&
+                    header.byte_order == 0x01020304 &&
+                    header.value_size == sizeof(Value) &&
+                    header.hash_check == hash_check() &&
+                    std::isfinite(header.cell_size) &&
+                    header.cell_size > 0 &&
+                    header.cell_size <= (double)std::numeric_limits<real>::max() &&
+                    (real)header.cell_size > 0 &&
+                    header.index_size > 0 &&
+                    (header.index_size & (header.index_size - 1)) == 0 &&
+                    header.cell_count < EMPTY &&
+                    header.value_count <= UINT32_MAX &&
+                    header.cells_offset % SECTION_ALIGNMENT == 0 &&
+                    header.values_offset % SECTION_ALIGNMENT == 0 &&
+                    header.index_offset % SECTION_ALIGNMENT == 0 &&
+                    section_fits(header.cells_offset, header.cell_count, sizeof(Cell), size) &&
+                    section_fits(header.values_offset, header.value_count, sizeof(Value), size) &&
+                    section_fits(header.index_offset, header.index_size, sizeof(uint32_t), size);
+
+        if (!fits)
+            return false;
+
+        const char *bytes = static_cast<const char *>(data);
+        const Cell *cells = reinterpret_cast<const Cell *>(bytes + header.cells_offset);
+        const uint32_t *index = reinterpret_cast<const uint32_t *>(bytes + header.index_offset);
+
+        // queries index cells and values without checking, so every one of them has to point inside its section
+        for (size_t i = 0; i < header.cell_count; i++)
+        {
+            if (cells[i].first > cells[i].last || cells[i].last > header.value_count)
+                return false;
+        }
+
+        // lookups stop after the longest probe, recounted from the index it has to match the one that was written
+        size_t max_probes = 0;
+
+        for (size_t at = 0; at < header.index_size; at++)
+        {
+            if (index[at] == EMPTY)
+                continue;
+            else if (index[at] >= header.cell_count)
+                return false;
+
+            const Cell &cell = cells[index[at]];
+            size_t home = slot(cell.x, cell.y, cell.salt, header.index_size);
+            max_probes = std::max<size_t>(max_probes, ((at - home) & (header.index_size - 1)) + 1);
+        }
+
+        if (header.max_probes != max_probes)
+            return false;
+
+        _staged.clear();
+        _cells.clear();
+        _values.clear();
+        _index.clear();
+        _mapping.reset();
+
+        _cell_size = header.cell_size;
+        _coordinates.set_cell_size((real)header.cell_size);
+        _snapshot = {
+            cells, header.cell_count,
+            reinterpret_cast<const Value *>(bytes + header.values_offset), header.value_count,
+            index, header.index_size,
+            max_probes};
+
+        return true;
+    }
+
+#if defined(SHASH_FILE_IO)
+    template <typename Value, typename HashFunction, typename Coordinates>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::save(const char *path) const
+    {
+        std::vector<char> buffer(serialized_size());
+        serialize(buffer.data());
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(buffer.data(), buffer.size());
+        return (bool)file;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::load(const char *path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || status.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        size_t size = status.st_size;
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED)
+            return false;
+
+        std::shared_ptr<const void> mapping(data, [size](const void *address) { munmap(const_cast<void *>(address), size); });
+#else
+        // no mmap, read the file into aligned memory instead
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+
+        size_t size = file.tellg();
+        auto buffer = std::make_shared<std::vector<uint64_t>>((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        file.seekg(0);
+        file.read(reinterpret_cast<char *>(buffer->data()), size);
+        if (!file)
+            return false;
+
+        std::shared_ptr<const void> mapping(buffer, buffer->data());
+        const void *data = buffer->data();
+#endif
+
+        if (!attach(data, size))
+            return false;
+
+        _mapping = mapping;
+        return true;
+    }
+#endif
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::align_section(size_t offset)
+    {
+        return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::section_fits(uint64_t offset, uint64_t count, size_t element_size, size_t size)
+    {
+        return offset <= size && count <= (size - offset) / element_size;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    uint32_t FrozenSpatialHash<Value, HashFunction, Coordinates>::hash_check()
+    {
+        // a snapshot written with another hash function would send every lookup to the wrong slot
+        return HashFunction::hash(0x12345678u, 0x9abcdef0u, 42u, 0u);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    int FrozenSpatialHash<Value, HashFunction, Coordinates>::cell(real coordinate) const
+    {
+        return _coordinates.cell(coordinate);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    const typename FrozenSpatialHash<Value, HashFunction, Coordinates>::Cell *FrozenSpatialHash<Value, HashFunction, Coordinates>::find_cell(int x, int y, int salt) const
+    {
+        if (_snapshot.index_size == 0)
+            return nullptr;
+
+        size_t at = slot(x, y, salt, _snapshot.index_size);
+
+        for (size_t i = 0; i < _snapshot.max_probes && _snapshot.index[at] != EMPTY; i++, at = (at + 1) & (_snapshot.index_size - 1))
+        {
+            const Cell &cell = _snapshot.cells[_snapshot.index[at]];
+            if (cell.x == x && cell.y == y && cell.salt == salt)
+                return &cell;
+        }
+
+        return nullptr;
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    size_t FrozenSpatialHash<Value, HashFunction, Coordinates>::slot(int x, int y, int salt, size_t index_size)
+    {
+        return HashFunction::hash(x, y, salt, 0) & (index_size - 1);
+    }
+
+    template <typename Value, typename HashFunction, typename Coordinates>
+    template <typename Visitor>
+    bool FrozenSpatialHash<Value, HashFunction, Coordinates>::for_each_span_at_cells(Visitor &&visitor, int top_left_x, int top_left_y, int bottom_right_x, int bottom_right_y, int salt) const
+    {
+        if (top_left_x > bottom_right_x || top_left_y > bottom_right_y)
+            return true;
+
+        // large rectangles scan the Morton range of their corners instead of looking up every cell
+        auto before = [](const Cell &cell, const std::pair<int, uint64_t> &key) {
+            return cell.salt != key.first ? cell.salt < key.first : detail::morton_code(cell.x, cell.y) < key.second;
+        };
+
+        auto after = [](const std::pair<int, uint64_t> &key, const Cell &cell) {
+            return key.first != cell.salt ? key.first < cell.salt : key.second < detail::morton_code(cell.x, cell.y);
+        };
+
+        const Cell *cells_end = _snapshot.cells + _snapshot.cell_count;
+        const Cell *first = std::lower_bound(_snapshot.cells, cells_end, std::make_pair(salt, detail::morton_code(top_left_x, top_left_y)), before);
+        const Cell *last = std::upper_bound(first, cells_end, std::make_pair(salt, detail::morton_code(bottom_right_x, bottom_right_y)), after);
+
+        double area = ((double)bottom_right_x - top_left_x + 1) * ((double)bottom_right_y - top_left_y + 1);
+
+        if ((double)(last - first) < area)
+        {
+            for (const Cell *cell = first; cell != last; ++cell)
+            {
+                if (cell->x < top_left_x || cell->x > bottom_right_x || cell->y < top_left_y || cell->y > bottom_right_y)
+                    continue;
+
+                if (!detail::visit(visitor, _snapshot.values + cell->first, _snapshot.values + cell->last))
+                    return false;
+            }
+
+            return true;
+        }
+
+        return detail::for_each_cell_in_aabb(top_left_x, top_left_y, bottom_right_x, bottom_right_y, [&](int x, int y) {
+            return for_each_span_at_cell(visitor, x, y, salt);
+        });
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::query_at_cell(
-        std::vector<Value> &result,
-        int x,
-        int y,
-        int salt)
+    // BUFFERS instances of Hash, one writer builds the next frame while readers query the last published one
+    // Hash needs a (cell_size, table_size, resource) constructor
+    template <typename Hash, size_t BUFFERS = 2>
+    class BufferedSpatialHash
+    {
+        static_assert(BUFFERS >= 2, "a single buffer cannot be built while it is read");
+
+    public:
+        using real = typename Hash::real;
+
+        class ReadView
+        {
+        public:
+            ReadView(ReadView &&other);
+            ReadView(const ReadView &) = delete;
+            ReadView &operator=(const ReadView &) = delete;
+            ~ReadView();
+
+            const Hash &operator*() const;
+            const Hash *operator->() const;
+
+            // number of publish() calls that happened before this buffer was published
+            size_t frame() const;
+
+        private:
+            friend class BufferedSpatialHash;
+
+            ReadView(const BufferedSpatialHash *owner, size_t buffer);
+
+            const BufferedSpatialHash *_owner;
+            size_t _buffer;
+        };
+
+        BufferedSpatialHash(
+            real cell_size,
+            unsigned int table_size,
+            std::pmr::memory_resource *upstream = std::pmr::get_default_resource());
+
+        // writer side, waits until a buffer other than the published one has no readers left, resets and returns it
+        Hash &begin_build(real cell_size, unsigned int table_size);
+
+        // makes the buffer of the last begin_build the one new readers get
+        void publish();
+
+        // reader side, safe from any thread at any time
+        ReadView read() const;
+
+        // frames published so far
+        size_t frame() const;
+
+    private:
+        struct Buffer
+        {
+            Hash hash;
+            size_t frame = 0;
+            mutable std::atomic<unsigned int> readers{0};
+
+            Buffer(real cell_size, unsigned int table_size, std::pmr::memory_resource *resource);
+        };
+
+        // the writer is the only one allocating or freeing, so the pool needs no lock
+        std::pmr::unsynchronized_pool_resource _pool;
+        std::vector<std::unique_ptr<Buffer>> _buffers;
+
+        std::atomic<size_t> _published{0};
+        size_t _building = 0;
+        size_t _frame = 0;
+    };
+
+    template <typename Hash, size_t BUFFERS>
+    BufferedSpatialHash<Hash, BUFFERS>::ReadView::ReadView(const BufferedSpatialHash *owner, size_t buffer)
+        : _owner(owner),
+          _buffer(buffer)
     {
-        HashBucket *bucket = get_bucket(x, y, salt);
-        result.insert(result.begin(), bucket->data.begin(), bucket->data.end());
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::query_at_point(
-        std::vector<Value> &result,
+    template <typename Hash, size_t BUFFERS>
+    BufferedSpatialHash<Hash, BUFFERS>::ReadView::ReadView(ReadView &&other)
+        : _owner(other._owner),
+          _buffer(other._buffer)
+    {
+        other._owner = nullptr;
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    BufferedSpatialHash<Hash, BUFFERS>::ReadView::~ReadView()
+    {
+        if (_owner != nullptr)
+            _owner->_buffers[_buffer]->readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    const Hash &BufferedSpatialHash<Hash, BUFFERS>::ReadView::operator*() const
+    {
+        return _owner->_buffers[_buffer]->hash;
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    const Hash *BufferedSpatialHash<Hash, BUFFERS>::ReadView::operator->() const
+    {
+        return &_owner->_buffers[_buffer]->hash;
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    size_t BufferedSpatialHash<Hash, BUFFERS>::ReadView::frame() const
+    {
+        return _owner->_buffers[_buffer]->frame;
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    BufferedSpatialHash<Hash, BUFFERS>::Buffer::Buffer(real cell_size, unsigned int table_size, std::pmr::memory_resource *resource)
+        : hash(cell_size, table_size, resource)
+    {
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    BufferedSpatialHash<Hash, BUFFERS>::BufferedSpatialHash(
+        real cell_size,
+        unsigned int table_size,
+        std::pmr::memory_resource *upstream)
+        : _pool(upstream)
+    {
+        for (size_t buffer = 0; buffer < BUFFERS; buffer++)
+            _buffers.push_back(std::make_unique<Buffer>(cell_size, table_size, &_pool));
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    Hash &BufferedSpatialHash<Hash, BUFFERS>::begin_build(real cell_size, unsigned int table_size)
+    {
+        size_t published = _published.load(std::memory_order_relaxed);
+
+        // a reader that pinned a buffer before checking the publish again is seen here, one that pins it afterwards
+        // sees that it is no longer published and lets go
+        for (size_t buffer = (published + 1) % BUFFERS;; buffer = (buffer + 1) % BUFFERS)
+        {
+            if (buffer == published)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            if (_buffers[buffer]->readers.load() == 0)
+            {
+                _building = buffer;
+                break;
+            }
+        }
+
+        Buffer &building = *_buffers[_building];
+        building.hash.reset(cell_size, table_size);
+        return building.hash;
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    void BufferedSpatialHash<Hash, BUFFERS>::publish()
+    {
+        _frame += 1;
+        _buffers[_building]->frame = _frame;
+        _published.store(_building);
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    typename BufferedSpatialHash<Hash, BUFFERS>::ReadView BufferedSpatialHash<Hash, BUFFERS>::read() const
+    {
+        while (true)
+        {
+            size_t buffer = _published.load();
+            _buffers[buffer]->readers.fetch_add(1);
+
+            if (_published.load() == buffer)
+                return ReadView(this, buffer);
+
+            _buffers[buffer]->readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    template <typename Hash, size_t BUFFERS>
+    size_t BufferedSpatialHash<Hash, BUFFERS>::frame() const
+    {
+        return _frame;
+    }
+
+    // keeps the bounds of every value next to it, queries only report true hits, each of them once
+    template <typename Value, typename HashFunction = hashing::Murmur, typename ReduceFunction = reduction::FastRange, size_t REHASH_ROUNDS = 5, typename Storage = storage::Vector, typename Coordinates = coordinates::Scaled<>>
+    class BoundedSpatialHash
+    {
+    public:
+        struct Entry
+        {
+            float bounds[4];
+            Value value;
+
+            // stores erase by value, bounds only decide which cells an entry lives in
+            inline bool operator==(const Entry &other) const
+            {
+                return value == other.value;
+            }
+        };
+
+        using Hash = SpatialHash<Entry, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>;
+        using real = typename Hash::real;
+
+        BoundedSpatialHash(
+            real cell_size,
+            unsigned int table_size,
+            std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        void reset(real cell_size, unsigned int table_size);
+
+        void insert_at_point(
+            real x,
+            real y,
+            Value &value,
+            int salt = 0);
+
+        void insert_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            Value &value,
+            int salt = 0);
+
+        // the bounds passed to insert, they pick the cells to remove value from
+        bool remove_at_aabb(
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            const Value &value,
+            int salt = 0);
+
+        // values whose bounds contain the point
+        void query_at_point(
+            std::vector<Value> &result,
+            real x,
+            real y,
+            int salt = 0) const;
+
+        // values whose bounds overlap the rectangle
+        void query_at_aabb(
+            std::vector<Value> &result,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        // values whose bounds intersect the disc
+        void query_at_radius(
+            std::vector<Value> &result,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_aabb(
+            Visitor &&visitor,
+            real top_left_x,
+            real top_left_y,
+            real bottom_right_x,
+            real bottom_right_y,
+            int salt = 0) const;
+
+        template <typename Visitor>
+        bool for_each_at_radius(
+            Visitor &&visitor,
+            real center_x,
+            real center_y,
+            real radius,
+            int salt = 0) const;
+
+        const Hash &hash() const;
+
+    private:
+        struct Bounds
+        {
+            float lower_x, lower_y, upper_x, upper_y;
+        };
+
+        static float round_down(real coordinate);
+        static float round_up(real coordinate);
+        static Bounds outward(real top_left_x, real top_left_y, real bottom_right_x, real bottom_right_y);
+
+        // float bounds back to real, still outward, an integral real would truncate them toward zero
+        static real lower(float coordinate);
+        static real upper(float coordinate);
+
+        // true if the entry overlaps the query given as (max_x, max_y, -min_x, -min_y)
+        static bool overlaps(const Entry &entry, const float *query);
+
+        // bit i is set if entries[i] overlaps the query, for the four entries starting at entries
+        static unsigned int overlaps4(const Entry *entries, const float *query);
+
+        // visitor(entry) for every entry overlapping the bounds, once per entry
+        template <typename Visitor>
+        bool for_each_overlapping(Visitor &&visitor, const Bounds &bounds, real center_x, real center_y, int salt) const;
+
+        Hash _hash;
+    };
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::BoundedSpatialHash(
+        real cell_size,
+        unsigned int table_size,
+        std::pmr::memory_resource *resource)
+        : _hash(cell_size, table_size, resource)
+    {
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::reset(real cell_size, unsigned int table_size)
+    {
+        _hash.reset(cell_size, table_size);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_point(
         real x,
         real y,
+        Value &value,
         int salt)
     {
-        int cell_x = cell(x);
-        int cell_y = cell(y);
+        insert_at_aabb(x, y, x, y, value, salt);
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::insert_at_aabb(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        Value &value,
+        int salt)
+    {
+        Bounds bounds = outward(top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+        Entry entry{{bounds.lower_x, bounds.lower_y, -bounds.upper_x, -bounds.upper_y}, value};
 
-        query_at_cell(result, cell_x, cell_y, salt);
+        // the cells follow the rounded bounds, so that the cell a hit is reported in is always one the entry is in
+        detail::for_each_cell_in_aabb(
+            _hash.cell(lower(bounds.lower_x)), _hash.cell(lower(bounds.lower_y)), _hash.cell(upper(bounds.upper_x)), _hash.cell(upper(bounds.upper_y)),
+            [&](int x, int y) {
+                _hash.insert_at_cell(x, y, entry, salt);
+                return true;
+            });
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::query_at_aabb(
-        std::vector<Value> &result,
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    bool BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::remove_at_aabb(
         real top_left_x,
         real top_left_y,
         real bottom_right_x,
         real bottom_right_y,
+        const Value &value,
         int salt)
     {
-        int top_left_x_cell = cell(top_left_x);
-        int top_left_y_cell = cell(top_left_y);
-        int bottom_right_x_cell = cell(bottom_right_x);
-        int bottom_right_y_cell = cell(bottom_right_y);
+        Bounds bounds = outward(top_left_x, top_left_y, bottom_right_x, bottom_right_y);
+        Entry entry{{}, value};
+        bool removed = true;
 
-        for (int i = top_left_x_cell; i <= bottom_right_x_cell; i++)
-        {
-            for (int j = top_left_y_cell; j <= bottom_right_y_cell; j++)
-            {
-                query_at_cell(result, i, j, salt);
-            }
-        }
+        detail::for_each_cell_in_aabb(
+            _hash.cell(lower(bounds.lower_x)), _hash.cell(lower(bounds.lower_y)), _hash.cell(upper(bounds.upper_x)), _hash.cell(upper(bounds.upper_y)),
+            [&](int x, int y) {
+                removed &= _hash.remove_at_cell(x, y, entry, salt);
+                return true;
+            });
+
+        return removed;
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    void SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::query_at_segment(
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_point(
         std::vector<Value> &result,
-        real start_x_coord,
-        real start_y_coord,
-        real end_x_coord,
-        real end_y_coord,
-        int salt)
+        real x,
+        real y,
+        int salt) const
     {
-        int x0 = cell(start_x_coord);
-        int y0 = cell(start_y_coord);
-        int x1 = cell(end_x_coord);
-        int y1 = cell(end_y_coord);
+        query_at_aabb(result, x, y, x, y, salt);
+    }
 
-        int dx = std::abs(x1 - x0);
-        int dy = std::abs(y1 - y0);
-        int sx = x0 < x1 ? 1 : -1;
-        int sy = y0 < y1 ? 1 : -1;
-        int err = dx + dy;
-        int e2;
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_aabb(
+        std::vector<Value> &result,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        for_each_at_aabb([&result](const Value &value) { result.push_back(value); }, top_left_x, top_left_y, bottom_right_x, bottom_right_y, salt);
+    }
 
-        while (true)
-        {
-            query_at_cell(result, x0, y0, salt);
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    void BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::query_at_radius(
+        std::vector<Value> &result,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        for_each_at_radius([&result](const Value &value) { result.push_back(value); }, center_x, center_y, radius, salt);
+    }
 
-            if (x0 == x1 && y0 == y1)
-                break;
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_aabb(
+        Visitor &&visitor,
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y,
+        int salt) const
+    {
+        Bounds bounds = outward(top_left_x, top_left_y, bottom_right_x, bottom_right_y);
 
-            e2 = 2 * err;
+        // the nearest point of an overlapping entry to the rectangle is the upper left corner of the overlap
+        return for_each_overlapping(
+            [&visitor](const Entry &entry) { return detail::visit(visitor, entry.value); },
+            bounds, top_left_x, top_left_y, salt);
+    }
 
-            if (e2 > dy)
-            {
-                err += dy;
-                x0 += sx;
-            }
-            else if (e2 < dx)
-            {
-                err += dx;
-                y0 += sy;
-            }
-        }
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_at_radius(
+        Visitor &&visitor,
+        real center_x,
+        real center_y,
+        real radius,
+        int salt) const
+    {
+        if (radius < 0)
+            return true;
+
+        // the bounding box of the disc is tested in the bucket, the few entries passing it get the exact test
+        Bounds bounds = outward(center_x - radius, center_y - radius, center_x + radius, center_y + radius);
+        double radius_squared = (double)radius * (double)radius;
+
+        return for_each_overlapping(
+            [&](const Entry &entry) {
+                double dx = std::max(std::max((double)entry.bounds[0] - center_x, (double)center_x + entry.bounds[2]), 0.0);
+                double dy = std::max(std::max((double)entry.bounds[1] - center_y, (double)center_y + entry.bounds[3]), 0.0);
+                if (dx * dx + dy * dy > radius_squared)
+                    return true;
+
+                return detail::visit(visitor, entry.value);
+            },
+            bounds, center_x, center_y, salt);
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    int SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::cell(real coordinate) const
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    const typename BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::Hash &BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::hash() const
     {
-        return std::floor(coordinate * _inv_cell_size);
+        return _hash;
     }
 
-    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS>
-    typename SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::HashBucket *
-    SpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS>::get_bucket(int x, int y, int salt)
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    float BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::round_down(real coordinate)
     {
-        uint32_t buf[4];
-        buf[0] = x;
-        buf[1] = y;
-        buf[2] = salt;
-        buf[3] = _current_round;
+        float rounded = (float)coordinate;
+        if ((double)rounded > (double)coordinate)
+            rounded = std::nextafter(rounded, -std::numeric_limits<float>::infinity());
+        return rounded;
+    }
 
-        HashBucket *bucket;
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    float BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::round_up(real coordinate)
+    {
+        float rounded = (float)coordinate;
+        if ((double)rounded < (double)coordinate)
+            rounded = std::nextafter(rounded, std::numeric_limits<float>::infinity());
+        return rounded;
+    }
 
-        for (size_t i = 0; i <= REHASH_ROUNDS; i++)
-        {
-            buf[3] += 1;
-            bucket = &_hash_table[ReduceFunction::reduce(HashFunction::hash((void *)buf), _table_size)];
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    typename BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::Bounds BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::outward(
+        real top_left_x,
+        real top_left_y,
+        real bottom_right_x,
+        real bottom_right_y)
+    {
+        return {round_down(top_left_x), round_down(top_left_y), round_up(bottom_right_x), round_up(bottom_right_y)};
+    }
 
-            if (bucket->last_claimed != _current_round)
-            {
-                bucket->last_claimed = _current_round;
-                bucket->data.clear();
-                bucket->x = x;
-                bucket->y = y;
-                break;
-            }
-            else if (bucket->x == x && bucket->y == y)
-            {
-                break;
-            }
-        }
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    typename BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::real BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::lower(float coordinate)
+    {
+        if constexpr (std::is_integral<real>::value)
+            return (real)std::floor(coordinate);
+        else
+            return (real)coordinate;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    typename BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::real BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::upper(float coordinate)
+    {
+        if constexpr (std::is_integral<real>::value)
+            return (real)std::ceil(coordinate);
+        else
+            return (real)coordinate;
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    bool BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::overlaps(const Entry &entry, const float *query)
+    {
+#if defined(__SSE__)
+        return _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(entry.bounds), _mm_loadu_ps(query))) == 0xf;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        return vminvq_u32(vcleq_f32(vld1q_f32(entry.bounds), vld1q_f32(query))) != 0;
+#else
+        return (entry.bounds[0] <= query[0]) & (entry.bounds[1] <= query[1]) & (entry.bounds[2] <= query[2]) & (entry.bounds[3] <= query[3]);
+#endif
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    unsigned int BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::overlaps4(const Entry *entries, const float *query)
+    {
+#if defined(__SSE__)
+        __m128 min_x = _mm_loadu_ps(entries[0].bounds);
+        __m128 min_y = _mm_loadu_ps(entries[1].bounds);
+        __m128 max_x = _mm_loadu_ps(entries[2].bounds);
+        __m128 max_y = _mm_loadu_ps(entries[3].bounds);
+
+        // one register per bound, lane i holding the bound of entries[i]
+        _MM_TRANSPOSE4_PS(min_x, min_y, max_x, max_y);
+
+        __m128 hits = _mm_and_ps(
+            _mm_and_ps(_mm_cmple_ps(min_x, _mm_set1_ps(query[0])), _mm_cmple_ps(min_y, _mm_set1_ps(query[1]))),
+            _mm_and_ps(_mm_cmple_ps(max_x, _mm_set1_ps(query[2])), _mm_cmple_ps(max_y, _mm_set1_ps(query[3]))));
+
+        return _mm_movemask_ps(hits);
+#else
+        unsigned int hits = 0;
+
+        for (unsigned int i = 0; i < 4; i++)
+            hits |= (unsigned int)overlaps(entries[i], query) << i;
+
+        return hits;
+#endif
+    }
+
+    template <typename Value, typename HashFunction, typename ReduceFunction, size_t REHASH_ROUNDS, typename Storage, typename Coordinates>
+    template <typename Visitor>
+    bool BoundedSpatialHash<Value, HashFunction, ReduceFunction, REHASH_ROUNDS, Storage, Coordinates>::for_each_overlapping(Visitor &&visitor, const Bounds &bounds, real center_x, real center_y, int salt) const
+    {
+        const float query[4] = {bounds.upper_x, bounds.upper_y, -bounds.lower_x, -bounds.lower_y};
+
+        return detail::for_each_cell_in_aabb(
+            _hash.cell(lower(bounds.lower_x)), _hash.cell(lower(bounds.lower_y)), _hash.cell(upper(bounds.upper_x)), _hash.cell(upper(bounds.upper_y)),
+            [&](int x, int y) {
+                // the point of the entry nearest to the center, clamped into the query, lies in one cell only
+                auto report = [&](const Entry &entry) {
+                    real nearest_x = std::min(std::max((real)center_x, lower(entry.bounds[0])), upper(-entry.bounds[2]));
+                    real nearest_y = std::min(std::max((real)center_y, lower(entry.bounds[1])), upper(-entry.bounds[3]));
+                    nearest_x = std::min(std::max(nearest_x, lower(bounds.lower_x)), upper(bounds.upper_x));
+                    nearest_y = std::min(std::max(nearest_y, lower(bounds.lower_y)), upper(bounds.upper_y));
+
+                    if (_hash.cell(nearest_x) != x || _hash.cell(nearest_y) != y)
+                        return true;
+
+                    return (bool)visitor(entry);
+                };
+
+                return _hash.for_each_span_at_cell(
+                    [&](const Entry *first, const Entry *last) {
+                        const Entry *entry = first;
+
+                        for (; last - entry >= 4; entry += 4)
+                        {
+                            unsigned int hits = overlaps4(entry, query);
+
+                            for (unsigned int i = 0; hits != 0; i++, hits >>= 1)
+                            {
+                                if ((hits & 1) && !report(entry[i]))
+                                    return false;
+                            }
+                        }
+
+                        for (; entry != last; entry++)
+                        {
+                            if (overlaps(*entry, query) && !report(*entry))
+                                return false;
+                        }
 
-        return bucket;
+                        return true;
+                    },
+                    x, y, salt);
+            });
     }
 
 }; // namespace shash
@@ -29,6 +29,9 @@ SOFTWARE.
 #include <array>
 #include <cstdlib>
 #include <chrono>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include "SpatialHash.h"
 
 struct Element
@@ -127,6 +130,64 @@ int realistic_speed_benchmark_all()
     return result;
 }
 
+template <typename HashFunction>
+int row_speed_benchmark(size_t row_length)
+{
+    uint32_t result = 0;
+    const uint32_t buckets = 4096;
+    std::vector<shash::HashValue> hashes(row_length);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i + row_length <= ELEMENTS.size(); i += row_length)
+    {
+        auto e = (&ELEMENTS[i]);
+        HashFunction::hash_row(e->x, e->y, e->salt, e->pepper, hashes.data(), row_length);
+
+        for (auto &hash : hashes)
+            result += shash::reduction::FastRange::reduce(hash, buckets);
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    std::cout << duration << " milliseconds " << std::endl;
+
+    return result;
+}
+
+template <typename HashFunction>
+int row_speed_benchmark_lengths()
+{
+    int result = 0;
+    for (size_t row_length : {1, 8, 16, 64})
+    {
+        std::cout << "\t  Row " << row_length << ": \t\t";
+        result += row_speed_benchmark<HashFunction>(row_length);
+    }
+
+    return result;
+}
+
+int row_speed_benchmark_all()
+{
+    int result = 0;
+
+    std::cout << "Row Speed Benchmark: " << ELEMENTS.size() << " Keys" << std::endl;
+
+    std::cout << "\tCustom" << std::endl;
+    result += row_speed_benchmark_lengths<shash::hashing::Custom>();
+
+    std::cout << "\tKnuth" << std::endl;
+    result += row_speed_benchmark_lengths<shash::hashing::Knuth>();
+
+    std::cout << "\txxHash" << std::endl;
+    result += row_speed_benchmark_lengths<shash::hashing::xxHash>();
+
+    std::cout << "\tMurmur" << std::endl;
+    result += row_speed_benchmark_lengths<shash::hashing::Murmur>();
+
+    return result;
+}
+
 int realistic_quality_benchmark(shash::HashFuncPtr h, shash::ReduceFuncPtr r)
 {
     int result = 0;
@@ -249,13 +310,88 @@ int realistic_quality_benchmark_all()
     return result;
 }
 
+template <typename InsertFunction>
+double concurrent_insert_benchmark(unsigned int thread_count, size_t elements, InsertFunction insert)
+{
+    std::vector<std::thread> threads;
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (unsigned int t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([t, thread_count, elements, &insert]() {
+            for (size_t i = elements * t / thread_count; i < elements * (t + 1) / thread_count; i++)
+            {
+                insert(ELEMENTS[i], (uint32_t)i);
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
+}
+
+int concurrent_insert_benchmark_all()
+{
+    const size_t elements = 4000000;
+    const unsigned int table_size = elements * 2;
+
+    std::cout << "Concurrent Insert Benchmark: " << elements << " Points" << std::endl;
+
+    shash::ConcurrentSpatialHash<uint32_t, shash::hashing::Murmur, shash::reduction::FastRange, 5, 4> concurrent_hash(1.0, table_size);
+    shash::SpatialHash<uint32_t> locked_hash(1.0, table_size);
+    using BulkHash = shash::SpatialHash<uint32_t>;
+    BulkHash bulk_hash(1.0, table_size);
+    std::mutex lock;
+
+    std::vector<uint32_t> indices(elements);
+    std::iota(indices.begin(), indices.end(), 0);
+
+    for (unsigned int thread_count : {1, 4, 8, 16})
+    {
+        concurrent_hash.reset(1.0, table_size);
+        double concurrent = concurrent_insert_benchmark(thread_count, elements, [&](const Element &e, uint32_t value) {
+            concurrent_hash.insert_at_point(e.x, e.y, value, e.salt);
+        });
+
+        locked_hash.reset(1.0, table_size);
+        double locked = concurrent_insert_benchmark(thread_count, elements, [&](const Element &e, uint32_t value) {
+            std::lock_guard<std::mutex> guard(lock);
+            locked_hash.insert_at_point(e.x, e.y, value, e.salt);
+        });
+
+        bulk_hash.reset(1.0, table_size);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        bulk_hash.bulk_insert(
+            indices.begin(), indices.end(),
+            [](uint32_t i) { return BulkHash::Key{(BulkHash::real)ELEMENTS[i].x, (BulkHash::real)ELEMENTS[i].y, (int)ELEMENTS[i].salt}; },
+            thread_count);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double bulk = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() / 1000.0;
+
+        std::cout
+            << "\t  Threads: " << std::setw(2) << thread_count
+            << "\t  Concurrent: " << std::fixed << std::setw(11) << std::setprecision(3) << elements / concurrent / 1000.0 << " Mops/s"
+            << "\t  Mutex: " << std::fixed << std::setw(11) << std::setprecision(3) << elements / locked / 1000.0 << " Mops/s"
+            << "\t  Bulk: " << std::fixed << std::setw(11) << std::setprecision(3) << elements / bulk / 1000.0 << " Mops/s"
+            << "\t  Overflows: " << concurrent_hash.overflows()
+            << std::endl;
+    }
+
+    return 0;
+}
+
 int main()
 {
     init_test_data();
 
     int result = 0;
     result += realistic_speed_benchmark_all();
+    result += row_speed_benchmark_all();
     result += realistic_quality_benchmark_all();
+    result += concurrent_insert_benchmark_all();
 
     std::cout << result << std::endl;
 
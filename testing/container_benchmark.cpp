@@ -0,0 +1,455 @@
+/*
+MIT License
+
+Copyright (c) 2020 Pawel Böning
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// benchmarks of the SpatialHash container itself, every workload is run REPETITIONS times and the fastest run is
+// reported in ns per operation, together with the hardware cache misses and the allocations of the hash per operation
+//
+// usage: container_benchmark [--quick] [filter], only benchmarks whose name contains filter are run
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "SpatialHash.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const int REPETITIONS = 5;
+
+// keeps the optimizer from dropping the query results
+static volatile uint64_t SINK = 0;
+
+// counts what the hash allocates through its memory resource
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    size_t allocations = 0;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        allocations += 1;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// hardware cache misses of the calling thread, unavailable without access to perf events
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        _fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if (_fd >= 0)
+            close(_fd);
+#endif
+    }
+
+    bool available() const
+    {
+        return _fd >= 0;
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+        if (_fd >= 0)
+        {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t stop()
+    {
+        uint64_t misses = 0;
+#if defined(__linux__)
+        if (_fd >= 0)
+        {
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_fd, &misses, sizeof(misses)) != sizeof(misses))
+                misses = 0;
+        }
+#endif
+        return misses;
+    }
+
+private:
+    int _fd = -1;
+};
+
+enum class Distribution
+{
+    UNIFORM,
+    CLUSTERED,
+};
+
+struct Object
+{
+    double x;
+    double y;
+    double extent;
+    double velocity_x;
+    double velocity_y;
+    uint32_t id;
+};
+
+struct Config
+{
+    size_t count;
+    double cell_size;
+    double load;
+    Distribution distribution;
+};
+
+struct Measurement
+{
+    double ns_per_op;
+    double misses_per_op;
+    double allocations_per_op;
+};
+
+// one object per unit square on average, clustered objects crowd around a few centers
+std::vector<Object> make_objects(size_t count, Distribution distribution)
+{
+    double world_size = std::sqrt((double)count);
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> position(0.0, world_size);
+    std::uniform_real_distribution<double> extent(0.0, 2.0);
+    std::uniform_real_distribution<double> velocity(-0.1, 0.1);
+    std::normal_distribution<double> spread(0.0, world_size / 64);
+
+    std::vector<std::pair<double, double>> centers;
+    for (int i = 0; i < 32; i++)
+        centers.push_back({position(generator), position(generator)});
+
+    std::vector<Object> objects(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Object &object = objects[i];
+
+        if (distribution == Distribution::UNIFORM)
+        {
+            object.x = position(generator);
+            object.y = position(generator);
+        }
+        else
+        {
+            const auto &center = centers[i % centers.size()];
+            object.x = center.first + spread(generator);
+            object.y = center.second + spread(generator);
+        }
+
+        object.extent = extent(generator);
+        object.velocity_x = velocity(generator);
+        object.velocity_y = velocity(generator);
+        object.id = (uint32_t)i;
+    }
+
+    return objects;
+}
+
+// setup runs untimed before every repetition, run does ops operations
+template <typename Setup, typename Run>
+Measurement measure(size_t ops, CountingResource &resource, CacheMissCounter &counter, Setup &&setup, Run &&run)
+{
+    Measurement best = {std::numeric_limits<double>::infinity(), 0.0, 0.0};
+
+    for (int repetition = 0; repetition < REPETITIONS; repetition++)
+    {
+        setup();
+
+        size_t allocations = resource.allocations;
+        counter.start();
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        run();
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        uint64_t misses = counter.stop();
+
+        double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count() / (double)ops;
+        if (ns < best.ns_per_op)
+            best = {ns, misses / (double)ops, (resource.allocations - allocations) / (double)ops};
+    }
+
+    return best;
+}
+
+void report(const std::string &name, const Measurement &measurement, const CacheMissCounter &counter)
+{
+    std::cout
+        << "\t" << std::left << std::setw(64) << name << std::right
+        << std::fixed << std::setprecision(1) << std::setw(10) << measurement.ns_per_op << " ns/op";
+
+    if (counter.available())
+        std::cout << std::setprecision(3) << std::setw(10) << measurement.misses_per_op << " misses/op";
+    else
+        std::cout << std::setw(10) << "n/a" << " misses/op";
+
+    std::cout << std::setprecision(4) << std::setw(10) << measurement.allocations_per_op << " allocs/op" << std::endl;
+}
+
+template <size_t REHASH_ROUNDS>
+void run_workloads(const Config &config, const std::string &filter, CacheMissCounter &counter)
+{
+    using Hash = shash::SpatialHash<uint32_t, shash::hashing::Murmur, shash::reduction::FastRange, REHASH_ROUNDS>;
+
+    std::ostringstream tag;
+    tag << (config.distribution == Distribution::UNIFORM ? "uniform" : "clustered")
+        << "/n=" << config.count << "/cell=" << config.cell_size << "/load=" << config.load << "/rounds=" << REHASH_ROUNDS;
+
+    auto selected = [&](const char *workload) {
+        return (std::string(workload) + "/" + tag.str()).find(filter) != std::string::npos;
+    };
+
+    auto name = [&](const char *workload) {
+        return std::string(workload) + "/" + tag.str();
+    };
+
+    std::vector<Object> objects = make_objects(config.count, config.distribution);
+    size_t count = objects.size();
+    unsigned int table_size = std::max(1.0, count / config.load);
+
+    CountingResource resource;
+    Hash hash(config.cell_size, table_size, &resource);
+
+    auto rebuild_points = [&]() {
+        hash.reset(config.cell_size, table_size);
+        for (Object &object : objects)
+            hash.insert_at_point(object.x, object.y, object.id);
+    };
+
+    auto rebuild_aabbs = [&]() {
+        hash.reset(config.cell_size, table_size);
+        for (Object &object : objects)
+            hash.insert_at_aabb(object.x, object.y, object.x + object.extent, object.y + object.extent, object.id);
+    };
+
+    // the first round grows the buckets, the measured ones run at steady state
+    rebuild_points();
+
+    if (selected("insert_point"))
+    {
+        report(name("insert_point"), measure(count, resource, counter, [&]() { hash.reset(config.cell_size, table_size); }, [&]() {
+                   for (Object &object : objects)
+                       hash.insert_at_point(object.x, object.y, object.id);
+               }),
+               counter);
+    }
+
+    if (selected("insert_batch"))
+    {
+        auto key_of = [](const Object &object) { return typename Hash::Key{object.x, object.y}; };
+
+        std::vector<uint32_t> ids;
+        for (const Object &object : objects)
+            ids.push_back(object.id);
+
+        report(name("insert_batch"), measure(count, resource, counter, [&]() { hash.reset(config.cell_size, table_size); }, [&]() {
+                   hash.insert_batch(ids.begin(), ids.end(), [&](uint32_t id) { return key_of(objects[id]); });
+               }),
+               counter);
+    }
+
+    if (selected("query_point"))
+    {
+        report(name("query_point"), measure(count, resource, counter, rebuild_points, [&]() {
+                   uint64_t sum = 0;
+                   for (const Object &object : objects)
+                       hash.for_each_at_point([&sum](uint32_t id) { sum += id; }, object.x, object.y);
+                   SINK = SINK + sum;
+               }),
+               counter);
+    }
+
+    if (selected("query_batch"))
+    {
+        std::vector<uint32_t> ids;
+        for (const Object &object : objects)
+            ids.push_back(object.id);
+
+        report(name("query_batch"), measure(count, resource, counter, rebuild_points, [&]() {
+                   uint64_t sum = 0;
+                   hash.query_batch(
+                       ids.begin(), ids.end(),
+                       [&](uint32_t id) { return typename Hash::Key{objects[id].x, objects[id].y}; },
+                       [&sum](size_t, const uint32_t *first, const uint32_t *last) {
+                           for (; first != last; first++)
+                               sum += *first;
+                       });
+                   SINK = SINK + sum;
+               }),
+               counter);
+    }
+
+    if (selected("insert_aabb"))
+    {
+        report(name("insert_aabb"), measure(count, resource, counter, [&]() { hash.reset(config.cell_size, table_size); }, [&]() {
+                   for (Object &object : objects)
+                       hash.insert_at_aabb(object.x, object.y, object.x + object.extent, object.y + object.extent, object.id);
+               }),
+               counter);
+    }
+
+    if (selected("query_aabb"))
+    {
+        report(name("query_aabb"), measure(count, resource, counter, rebuild_aabbs, [&]() {
+                   uint64_t sum = 0;
+                   for (const Object &object : objects)
+                       hash.for_each_at_aabb([&sum](uint32_t id) { sum += id; }, object.x - 2.0, object.y - 2.0, object.x + 2.0, object.y + 2.0);
+                   SINK = SINK + sum;
+               }),
+               counter);
+    }
+
+    if (selected("insert_segment"))
+    {
+        report(name("insert_segment"), measure(count, resource, counter, [&]() { hash.reset(config.cell_size, table_size); }, [&]() {
+                   for (Object &object : objects)
+                       hash.insert_at_segment(object.x, object.y, object.x + object.velocity_x * 40, object.y + object.velocity_y * 40, object.id);
+               }),
+               counter);
+    }
+
+    if (selected("query_segment"))
+    {
+        report(name("query_segment"), measure(count, resource, counter, rebuild_points, [&]() {
+                   uint64_t sum = 0;
+                   for (const Object &object : objects)
+                       hash.for_each_at_segment([&sum](uint32_t id) { sum += id; }, object.x, object.y, object.x + object.velocity_x * 40, object.y + object.velocity_y * 40);
+                   SINK = SINK + sum;
+               }),
+               counter);
+    }
+
+    if (selected("reset_rebuild"))
+    {
+        report(name("reset_rebuild"), measure(count, resource, counter, []() {}, rebuild_points), counter);
+    }
+
+    // every object moves a tenth of a cell per frame, most moves stay inside their cell
+    if (selected("move"))
+    {
+        std::vector<Object> moving = objects;
+
+        report(name("move"), measure(count, resource, counter, rebuild_points, [&]() {
+                   for (Object &object : moving)
+                   {
+                       double x = object.x + object.velocity_x;
+                       double y = object.y + object.velocity_y;
+                       hash.move_at_point(object.x, object.y, x, y, object.id);
+                       object.x = x;
+                       object.y = y;
+                   }
+               }),
+               counter);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = false;
+    std::string filter;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--quick")
+            quick = true;
+        else
+            filter = argv[i];
+    }
+
+    CacheMissCounter counter;
+    if (!counter.available())
+        std::cout << "perf events unavailable, cache misses are not measured" << std::endl;
+
+    std::vector<size_t> counts = quick ? std::vector<size_t>{10000, 100000} : std::vector<size_t>{10000, 100000, 1000000};
+    size_t sweep_count = 100000;
+
+    std::cout << "Object Count and Distribution" << std::endl;
+    for (Distribution distribution : {Distribution::UNIFORM, Distribution::CLUSTERED})
+    {
+        for (size_t count : counts)
+            run_workloads<5>({count, 1.0, 0.5, distribution}, filter, counter);
+    }
+
+    std::cout << "Cell Size" << std::endl;
+    for (double cell_size : {0.25, 4.0})
+        run_workloads<5>({sweep_count, cell_size, 0.5, Distribution::UNIFORM}, filter, counter);
+
+    std::cout << "Table Size" << std::endl;
+    for (double load : {0.25, 1.0, 2.0})
+        run_workloads<5>({sweep_count, 1.0, load, Distribution::UNIFORM}, filter, counter);
+
+    std::cout << "Rehash Rounds" << std::endl;
+    run_workloads<2>({sweep_count, 1.0, 1.0, Distribution::UNIFORM}, filter, counter);
+    run_workloads<10>({sweep_count, 1.0, 1.0, Distribution::UNIFORM}, filter, counter);
+
+    std::cout << SINK % 2 << std::endl;
+
+    return 0;
+}
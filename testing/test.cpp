@@ -26,6 +26,10 @@ SOFTWARE.
 #include <algorithm>
 #include <vector>
 #include <chrono>
+#include <thread>
+#include <memory_resource>
+#include <numeric>
+#define SHASH_FILE_IO
 #include "SpatialHash.h"
 
 class SpatialHashTest
@@ -55,14 +59,2025 @@ public:
     {
         int result = 1;
 
+        result *= test_hash_row();
         result *= test_get_cell();
+        result *= test_coordinates();
         result *= test_insert_query_point();
         result *= test_insert_query_aabb();
         result *= test_insert_query_segment();
+        result *= test_arena_storage();
+        result *= test_for_each_query();
+        result *= test_unique_query();
+        result *= test_radius_query();
+        result *= test_knn_query();
+        result *= test_potential_pairs<shash::storage::Vector>();
+        result *= test_potential_pairs<shash::storage::Arena<4>>();
+        result *= test_potential_pairs<shash::storage::Inline<2>>();
+        result *= test_bulk_insert();
+        result *= test_batch_query();
+        result *= test_hierarchical();
+        result *= test_volume();
+        result *= test_layers();
+        result *= test_bounded();
+        result *= test_frozen();
+        result *= test_frozen_file();
+        result *= test_concurrent_query();
+        result *= test_concurrent_insert();
+        result *= test_buffered();
+        result *= test_remove_move();
+        result *= test_overflow();
+        result *= test_load_factor();
+        result *= test_stats();
+        result *= test_memory_resource<shash::storage::Vector>();
+        result *= test_memory_resource<shash::storage::Monotonic>();
+        result *= test_trim();
 
         return result;
     }
 
+    int test_arena_storage()
+    {
+        std::cout << "Test arena storage" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5> vector_hash(_cell_size, 42);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Arena<4>> arena_hash(_cell_size, 42);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Inline<2, 4>> inline_hash(_cell_size, 42);
+
+        for (auto &load : _load_factors)
+        {
+            vector_hash.reset(_cell_size, (int)(_test_size / load));
+            arena_hash.reset(_cell_size, (int)(_test_size / load));
+            inline_hash.reset(_cell_size, (int)(_test_size / load));
+
+            for (auto &e : _test_data)
+            {
+                vector_hash.insert_at_point(e.x, e.y, e.value, e.category);
+                arena_hash.insert_at_point(e.x, e.y, e.value, e.category);
+                inline_hash.insert_at_point(e.x, e.y, e.value, e.category);
+            }
+
+            std::vector<Id> expected;
+            std::vector<Id> result;
+            std::vector<Id> inlined;
+            for (auto &e : _test_data)
+            {
+                expected.clear();
+                result.clear();
+                inlined.clear();
+                vector_hash.query_at_point(expected, e.x, e.y, e.category);
+                arena_hash.query_at_point(result, e.x, e.y, e.category);
+                inline_hash.query_at_point(inlined, e.x, e.y, e.category);
+
+                std::sort(expected.begin(), expected.end());
+                std::sort(result.begin(), result.end());
+                std::sort(inlined.begin(), inlined.end());
+
+                if (expected != result || expected != inlined)
+                {
+                    std::cout << "\tFAIL, arena, inline and vector storage differ!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        Id val1 = 1;
+        Id val2 = 2;
+        arena_hash.reset(1.0, 1000);
+        arena_hash.insert_at_aabb(0.0, 0.0, 20.0, 20.0, val1, 1);
+        arena_hash.insert_at_aabb(10.0, 10.0, 30.0, 30.0, val2, 1);
+        for (int i = 0; i < 10; i++)
+            arena_hash.insert_at_point(20.0, 20.0, val1, 1);
+
+        std::vector<Id> result;
+        arena_hash.query_at_point(result, 20.0, 20.0, 1);
+        if (result.size() != 12)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    template <typename SpatialHash>
+    int test_for_each_query(SpatialHash &spatial_hash)
+    {
+        Id val1 = 1;
+        Id val2 = 2;
+
+        spatial_hash.insert_at_aabb(0.0, 0.0, 20.0, 20.0, val1, 1);
+        spatial_hash.insert_at_aabb(10.0, 10.0, 30.0, 30.0, val2, 1);
+        for (int i = 0; i < 10; i++)
+            spatial_hash.insert_at_point(20.0, 20.0, val1, 1);
+
+        std::vector<Id> expected;
+        std::vector<Id> result;
+        spatial_hash.query_at_aabb(expected, 5.0, 5.0, 25.0, 25.0, 1);
+        spatial_hash.for_each_at_aabb([&result](const Id &value) { result.push_back(value); }, 5.0, 5.0, 25.0, 25.0, 1);
+        if (result != expected)
+        {
+            std::cout << "\tFAIL, for_each and query differ!!" << std::endl;
+            return 0;
+        }
+
+        size_t visited = 0;
+        bool completed = spatial_hash.for_each_at_aabb(
+            [&visited](const Id &value) {
+                visited++;
+                return value != 2;
+            },
+            0.0, 0.0, 30.0, 30.0, 1);
+        if (completed || visited == 0 || visited >= expected.size())
+        {
+            std::cout << "\tFAIL, walk did not stop early!!" << std::endl;
+            return 0;
+        }
+
+        size_t spanned = 0;
+        spatial_hash.for_each_span_at_point([&spanned](const Id *first, const Id *last) { spanned += last - first; }, 20.0, 20.0, 1);
+
+        size_t ranged = 0;
+        for (auto &value : spatial_hash.range_at_point(20.0, 20.0, 1))
+            ranged += (value == 1 || value == 2);
+
+        if (spanned != 12 || ranged != 12 || !spatial_hash.range_at_point(-50.0, -50.0, 1).empty())
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        return 1;
+    }
+
+    int test_for_each_query()
+    {
+        std::cout << "Test for_each query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> vector_hash(1.0, 1000);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Arena<4>> arena_hash(1.0, 1000);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Inline<4, 4>> inline_hash(1.0, 1000);
+
+        if (!test_for_each_query(vector_hash) || !test_for_each_query(arena_hash) || !test_for_each_query(inline_hash))
+            return 0;
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_unique_query()
+    {
+        std::cout << "Test unique query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> spatial_hash(1.0, 10000);
+        shash::UniqueFilter<> filter;
+
+        Id val1 = 1;
+        Id val2 = 2;
+
+        spatial_hash.insert_at_aabb(0.0, 0.0, 20.0, 20.0, val1, 1);
+        spatial_hash.insert_at_aabb(10.0, 10.0, 30.0, 30.0, val2, 1);
+
+        std::vector<Id> result;
+        spatial_hash.query_at_aabb(result, filter, 18.0, 18.0, 20.0, 20.0, 1);
+        if (result.size() != 2)
+        {
+            std::cout << "\tFAIL, did not deduplicate data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_aabb(result, filter, 0.0, 0.0, 5.0, 5.0, 1);
+        if (result.size() != 1 || result[0] != val1)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_segment(result, filter, 0.0, 15.0, 30.0, 15.0, 1);
+        if (result.size() != 2)
+        {
+            std::cout << "\tFAIL, did not deduplicate data!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    template <typename SpatialHash>
+    int test_bulk_insert(unsigned int threads)
+    {
+        SpatialHash bulk_hash(_cell_size, 42);
+
+        for (auto &load : _load_factors)
+        {
+            bulk_hash.reset(_cell_size, (int)(_test_size / load));
+
+            std::vector<Id> values;
+            for (auto &e : _test_data)
+            {
+                values.push_back(&e - _test_data.data());
+            }
+
+            bulk_hash.bulk_insert(
+                values.begin(), values.end(),
+                [this](Id index) {
+                    auto &e = _test_data[index];
+                    return typename SpatialHash::Key{e.x, e.y, e.category};
+                },
+                threads);
+
+            std::vector<Id> result;
+            for (auto &e : _test_data)
+            {
+                result.clear();
+                bulk_hash.query_at_point(result, e.x, e.y, e.category);
+
+                if (std::count(result.begin(), result.end(), &e - _test_data.data()) != 1)
+                {
+                    std::cout << "\tFAIL, bulk insert lost or duplicated some data!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        // coarse cells hold many values, each of them in the order of serial insertion
+        real coarse_cell_size = _world_size / 64;
+        SpatialHash serial_hash(coarse_cell_size, _test_size / 4);
+        bulk_hash.reset(coarse_cell_size, _test_size / 4);
+
+        std::vector<Id> values;
+        for (auto &e : _test_data)
+        {
+            Id index = &e - _test_data.data();
+            values.push_back(index);
+            serial_hash.insert_at_point(e.x, e.y, index);
+        }
+
+        bulk_hash.bulk_insert(
+            values.begin(), values.end(),
+            [this](Id index) { return typename SpatialHash::Key{_test_data[index].x, _test_data[index].y, 0}; },
+            threads);
+
+        std::vector<Id> bulk_result;
+        std::vector<Id> serial_result;
+        for (auto &e : _test_data)
+        {
+            bulk_result.clear();
+            serial_result.clear();
+            bulk_hash.query_at_point(bulk_result, e.x, e.y);
+            serial_hash.query_at_point(serial_result, e.x, e.y);
+
+            if (bulk_result != serial_result)
+            {
+                std::cout << "\tFAIL, bulk insert changed the order inside a cell!!" << std::endl;
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    int test_bulk_insert()
+    {
+        std::cout << "Test bulk insert" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        using VectorHash = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5>;
+        using ArenaHash = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Arena<>>;
+
+        for (unsigned int threads : {1, 4})
+        {
+            if (!test_bulk_insert<VectorHash>(threads) || !test_bulk_insert<ArenaHash>(threads))
+                return 0;
+        }
+
+        // a pool resource is not thread safe, the parallel fill must not allocate from it
+        OwnerThreadResource resource;
+        VectorHash pooled_hash(_cell_size, _test_size * 2, &resource);
+
+        std::vector<Id> values;
+        for (auto &e : _test_data)
+            values.push_back(&e - _test_data.data());
+
+        pooled_hash.bulk_insert(
+            values.begin(), values.end(),
+            [this](Id index) { return VectorHash::Key{_test_data[index].x, _test_data[index].y, _test_data[index].category}; },
+            4);
+
+        std::vector<Id> result;
+        for (auto &e : _test_data)
+        {
+            result.clear();
+            pooled_hash.query_at_point(result, e.x, e.y, e.category);
+
+            if (std::count(result.begin(), result.end(), &e - _test_data.data()) != 1)
+            {
+                std::cout << "\tFAIL, bulk insert into a pool resource lost some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        if (resource.foreign_allocations != 0)
+        {
+            std::cout << "\tFAIL, bulk insert allocated from worker threads!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_batch_query()
+    {
+        std::cout << "Test batch query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5> batch_hash(_cell_size, _test_size * 2);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5> point_hash(_cell_size, _test_size * 2);
+
+        std::vector<Id> values;
+        for (auto &e : _test_data)
+        {
+            values.push_back(&e - _test_data.data());
+            point_hash.insert_at_point(e.x, e.y, values.back(), e.category);
+        }
+
+        auto key_of = [this](Id index) {
+            auto &e = _test_data[index];
+            return shash::SpatialHash<Id>::Key{e.x, e.y, e.category};
+        };
+
+        batch_hash.insert_batch(values.begin(), values.end(), key_of);
+
+        // every key sees the same values in the same order as a single lookup
+        std::vector<std::vector<Id>> found(values.size());
+        batch_hash.query_batch(values.begin(), values.end(), key_of, [&found](size_t index, const Id *first, const Id *last) {
+            found[index].insert(found[index].end(), first, last);
+        });
+
+        std::vector<Id> result;
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            auto &e = _test_data[i];
+            result.clear();
+            point_hash.query_at_point(result, e.x, e.y, e.category);
+
+            if (found[i] != result)
+            {
+                std::cout << "\tFAIL, batch differs from single lookups!!" << std::endl;
+                return 0;
+            }
+        }
+
+        size_t visited = 0;
+        bool completed = batch_hash.query_batch(values.begin(), values.end(), key_of, [&visited](size_t, const Id *, const Id *) {
+            return ++visited < 100;
+        });
+
+        if (completed || visited != 100)
+        {
+            std::cout << "\tFAIL, did not stop the batch!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_hierarchical()
+    {
+        std::cout << "Test hierarchical" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        struct Box
+        {
+            real top_left_x;
+            real top_left_y;
+            real bottom_right_x;
+            real bottom_right_y;
+        };
+
+        shash::HierarchicalSpatialHash<Id, 8> hierarchical_hash(1.0, 4096);
+
+        if (hierarchical_hash.level_of(0.5, 0.5, 1.5, 1.5) != 0 || hierarchical_hash.level_of(0.5, 0.5, 2.5, 0.5) != 1 ||
+            hierarchical_hash.level_of(-100, -100, 100, 100) != 7)
+        {
+            std::cout << "\tFAIL, picked the wrong level!!" << std::endl;
+            return 0;
+        }
+
+        // objects from a tenth of a cell up to a few hundred cells wide
+        std::vector<Box> boxes;
+        for (Id i = 0; i < 2000; i++)
+        {
+            real x = (real)(rand() % 2000) - 1000;
+            real y = (real)(rand() % 2000) - 1000;
+            real extent = i % 10 == 0 ? (real)(rand() % 300) : (real)(rand() % 10) * 0.1f;
+
+            boxes.push_back({x, y, x + extent, y + extent});
+            hierarchical_hash.insert_at_aabb(x, y, x + extent, y + extent, i);
+        }
+
+        std::vector<Id> result;
+        for (int query = 0; query < 200; query++)
+        {
+            real x = (real)(rand() % 2000) - 1000;
+            real y = (real)(rand() % 2000) - 1000;
+            Box area = {x, y, x + 20, y + 20};
+
+            result.clear();
+            hierarchical_hash.query_at_aabb(result, area.top_left_x, area.top_left_y, area.bottom_right_x, area.bottom_right_y);
+
+            for (Id i = 0; i < boxes.size(); i++)
+            {
+                const Box &box = boxes[i];
+                bool overlaps = box.top_left_x <= area.bottom_right_x && area.top_left_x <= box.bottom_right_x &&
+                                box.top_left_y <= area.bottom_right_y && area.top_left_y <= box.bottom_right_y;
+
+                if (overlaps && std::find(result.begin(), result.end(), i) == result.end())
+                {
+                    std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        // a box at the coarse levels only touches its few cells there
+        Id big = 1;
+        hierarchical_hash.reset(1.0, 4096);
+        hierarchical_hash.insert_at_aabb(-50, -50, 50, 50, big);
+
+        size_t visits = 0;
+        hierarchical_hash.for_each_at_aabb([&visits](Id) { visits++; }, -100, -100, 100, 100);
+
+        if (visits == 0 || visits > 4 || hierarchical_hash.levels_in_use() != (1u << hierarchical_hash.level_of(-50, -50, 50, 50)))
+        {
+            std::cout << "\tFAIL, big object fanned out!!" << std::endl;
+            return 0;
+        }
+
+        if (!hierarchical_hash.remove_at_aabb(-50, -50, 50, 50, big) || !hierarchical_hash.for_each_at_point([](Id) { return false; }, 0, 0))
+        {
+            std::cout << "\tFAIL, did not remove the object!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_volume()
+    {
+        std::cout << "Test volume" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        using VolumeHash = shash::SpatialHash3D<Id>;
+        VolumeHash volume_hash(_cell_size, _test_size * 2);
+
+        // the test data again, lifted into layers by category
+        for (auto &e : _test_data)
+            volume_hash.insert_at_point({e.x, (real)e.category, e.y}, e.value);
+
+        std::vector<Id> result;
+        for (auto &e : _test_data)
+        {
+            result.clear();
+            volume_hash.query_at_point(result, {e.x, (real)e.category, e.y});
+
+            if (std::find(result.begin(), result.end(), e.value) == result.end())
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        Id box = 1;
+        Id diagonal = 2;
+        volume_hash.reset(1.0, 1000);
+        volume_hash.insert_at_aabb({-0.5, -0.5, -0.5}, {1.5, 1.5, 1.5}, box, 1);
+        volume_hash.insert_at_segment({0.5, 0.5, 0.5}, {10.5, 10.5, 10.5}, diagonal, 2);
+
+        size_t box_cells = 0;
+        volume_hash.for_each_at_aabb([&box_cells](Id value) { box_cells += value == 1; }, {-10, -10, -10}, {10, 10, 10}, 1);
+
+        // an exact space diagonal only passes through the diagonal cells
+        result.clear();
+        volume_hash.query_at_point(result, {1.5, 0.5, 0.5}, 2);
+        size_t side = result.size();
+
+        result.clear();
+        volume_hash.query_at_point(result, {7.5, 7.5, 7.5}, 2);
+
+        if (box_cells != 27 || side != 0 || result.size() != 1 || result[0] != diagonal)
+        {
+            std::cout << "\tFAIL, walked the wrong cells!!" << std::endl;
+            return 0;
+        }
+
+        if (!volume_hash.remove_at_aabb({-0.5, -0.5, -0.5}, {1.5, 1.5, 1.5}, box, 1) || volume_hash.remove_at_point({1.5, 1.5, 1.5}, box, 1))
+        {
+            std::cout << "\tFAIL, did not remove the box!!" << std::endl;
+            return 0;
+        }
+
+        // chained hashing of more than three axes
+        shash::SpatialHashN<Id, 5> hyper_hash(1.0, 1000);
+        for (Id i = 0; i < 100; i++)
+            hyper_hash.insert_at_cell({0, 0, 0, (int)i, -(int)i}, i);
+
+        for (Id i = 0; i < 100; i++)
+        {
+            result.clear();
+            hyper_hash.query_at_cell(result, {0, 0, 0, (int)i, -(int)i});
+
+            if (result.size() != 1 || result[0] != i)
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        // the table of the plane, an empty table still probes a whole group and the load factor grows it
+        using ProbedVolumeHash = shash::SpatialHash3D<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Vector, shash::coordinates::Scaled<>, shash::statistics::Probes>;
+        ProbedVolumeHash probed_hash(1.0, 0);
+        probed_hash.set_load_factor(0.5);
+
+        std::vector<Id> values(1000);
+        std::iota(values.begin(), values.end(), 0);
+
+        auto key_of = [](Id value) {
+            return ProbedVolumeHash::Key{{(real)value, (real)(value % 7), -(real)value}, (int)(value % 3)};
+        };
+
+        for (int round = 0; round < 2; round++)
+        {
+            probed_hash.reset(1.0, 0);
+            probed_hash.insert_batch(values.begin(), values.end(), key_of);
+        }
+
+        std::vector<size_t> found(values.size(), 0);
+        probed_hash.query_batch(values.begin(), values.end(), key_of, [&found, &values](size_t index, const Id *first, const Id *last) {
+            found[index] += std::count(first, last, values[index]);
+        });
+
+        if (std::count(found.begin(), found.end(), 1) != (long)values.size())
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        ProbedVolumeHash::Stats stats = probed_hash.stats();
+        if (stats.table_size < 2000 || stats.claimed_buckets + stats.overflow_cells != values.size() || stats.values != values.size() || stats.probe_lengths.empty())
+        {
+            std::cout << "\tFAIL, did not grow the table!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_layers()
+    {
+        std::cout << "Test layers" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        enum Layer
+        {
+            PARTICLES,
+            PICKUPS,
+        };
+
+        // the dense layer is overfull, the sparse one has a small table of its own
+        shash::LayeredSpatialHash<Id, 2> layered_hash(_cell_size, {(unsigned int)_test_size / 2, 256});
+
+        for (auto &e : _test_data)
+            layered_hash.insert_at_point(e.x, e.y, e.value, PARTICLES);
+
+        std::vector<Object> pickups(_test_data.begin(), _test_data.begin() + 64);
+        for (auto &e : pickups)
+            layered_hash.insert_at_point(e.x, e.y, e.value, PICKUPS);
+
+        if (layered_hash.layer(PARTICLES).overflow_cells() == 0 || layered_hash.layer(PICKUPS).overflow_cells() != 0)
+        {
+            std::cout << "\tFAIL, layers share their probes!!" << std::endl;
+            return 0;
+        }
+
+        std::vector<Id> result;
+        for (auto &e : pickups)
+        {
+            size_t particles = 0;
+            size_t found = 0;
+            layered_hash.for_each_at_point(
+                [&](size_t layer, Id value) {
+                    particles += layer == PARTICLES && value == e.value;
+                    found += layer == PICKUPS && value == e.value;
+                },
+                e.x, e.y);
+
+            result.clear();
+            layered_hash.query_at_point(result, e.x, e.y, 1u << PICKUPS);
+
+            if (particles != 1 || found != 1 || std::count(result.begin(), result.end(), e.value) != 1)
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        layered_hash.reset(_cell_size);
+        result.clear();
+        layered_hash.query_at_aabb(result, -_world_size, -_world_size, -_world_size + 10, -_world_size + 10);
+
+        if (!result.empty() || layered_hash.layer(PICKUPS).table_size() < 256)
+        {
+            std::cout << "\tFAIL, reset did not keep the layers!!" << std::endl;
+            return 0;
+        }
+
+        // round arenas can neither be copied nor moved
+        shash::LayeredSpatialHash<Id, 2, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Monotonic> monotonic_hash(_cell_size, {1024, 256});
+
+        for (int round = 0; round < 2; round++)
+        {
+            monotonic_hash.reset(_cell_size);
+            for (auto &e : pickups)
+                monotonic_hash.insert_at_point(e.x, e.y, e.value, e.value % 2);
+
+            for (auto &e : pickups)
+            {
+                result.clear();
+                monotonic_hash.query_at_point(result, e.x, e.y, 1u << (e.value % 2));
+
+                if (std::count(result.begin(), result.end(), e.value) != 1)
+                {
+                    std::cout << "\tFAIL, did not find some data of a monotonic layer!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_bounded()
+    {
+        std::cout << "Test bounded" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        struct Box
+        {
+            real left, top, right, bottom;
+            Id value;
+        };
+
+        std::vector<Box> boxes;
+        for (Id i = 0; i < 4000; i++)
+        {
+            real x = (real)(rand() % 4000) * 0.05f - 100;
+            real y = (real)(rand() % 4000) * 0.05f - 100;
+            real extent = (real)(rand() % 50) * 0.1f;
+            boxes.push_back({x, y, x + extent, y + extent * 0.5f, i});
+        }
+
+        shash::BoundedSpatialHash<Id> bounded_hash(4, 4096);
+        shash::SpatialHash<Id> spatial_hash(4, 4096);
+
+        for (auto &b : boxes)
+        {
+            bounded_hash.insert_at_aabb(b.left, b.top, b.right, b.bottom, b.value);
+            spatial_hash.insert_at_aabb(b.left, b.top, b.right, b.bottom, b.value);
+        }
+
+        std::vector<Id> result;
+        std::vector<Id> expected;
+        size_t candidates = 0;
+        size_t hits = 0;
+
+        for (int i = 0; i < 500; i++)
+        {
+            real x = (real)(rand() % 4000) * 0.05f - 100;
+            real y = (real)(rand() % 4000) * 0.05f - 100;
+            real extent = (real)(rand() % 100) * 0.1f;
+
+            result.clear();
+            expected.clear();
+            bounded_hash.query_at_aabb(result, x, y, x + extent, y + extent);
+
+            for (auto &b : boxes)
+            {
+                if (b.left <= x + extent && x <= b.right && b.top <= y + extent && y <= b.bottom)
+                    expected.push_back(b.value);
+            }
+
+            std::sort(result.begin(), result.end());
+            if (result != expected)
+            {
+                std::cout << "\tFAIL, aabb query did not return exactly the overlapping values!!" << std::endl;
+                return 0;
+            }
+
+            result.clear();
+            expected.clear();
+            bounded_hash.query_at_radius(result, x, y, extent);
+
+            for (auto &b : boxes)
+            {
+                real dx = std::max(std::max(b.left - x, x - b.right), (real)0);
+                real dy = std::max(std::max(b.top - y, y - b.bottom), (real)0);
+                if (dx * dx + dy * dy <= extent * extent)
+                    expected.push_back(b.value);
+            }
+
+            std::sort(result.begin(), result.end());
+            if (result != expected)
+            {
+                std::cout << "\tFAIL, radius query did not return exactly the intersecting values!!" << std::endl;
+                return 0;
+            }
+
+            hits += expected.size();
+            result.clear();
+            spatial_hash.query_at_radius(result, x, y, extent);
+            candidates += result.size();
+        }
+
+        if (hits >= candidates)
+        {
+            std::cout << "\tFAIL, filtering did not drop any candidates!!" << std::endl;
+            return 0;
+        }
+
+        for (size_t i = 0; i < boxes.size(); i += 2)
+        {
+            if (!bounded_hash.remove_at_aabb(boxes[i].left, boxes[i].top, boxes[i].right, boxes[i].bottom, boxes[i].value))
+            {
+                std::cout << "\tFAIL, could not remove some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            size_t found = 0;
+            bounded_hash.for_each_at_aabb([&](Id value) { found += value == boxes[i].value; }, boxes[i].left, boxes[i].top, boxes[i].right, boxes[i].bottom);
+
+            if (found != i % 2)
+            {
+                std::cout << "\tFAIL, values were not reported exactly once!!" << std::endl;
+                return 0;
+            }
+        }
+
+        // integral coordinates around the origin, the float bounds have to map back onto the cells they were inserted at
+        using IntegralHash = shash::BoundedSpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Vector, shash::coordinates::Scaled<int>>;
+        IntegralHash integral_hash(1 << 16, 4096);
+
+        auto random_coordinate = []() { return (rand() % (1 << 20)) * 8 - (1 << 22); };
+
+        struct IntegralBox
+        {
+            int left, top, right, bottom;
+            Id value;
+        };
+
+        std::vector<IntegralBox> integral_boxes;
+        for (Id i = 0; i < 2000; i++)
+        {
+            int x = random_coordinate();
+            int y = random_coordinate();
+            int extent = rand() % (1 << 18);
+            integral_boxes.push_back({x, y, x + extent, y + extent / 2, i});
+            integral_hash.insert_at_aabb(x, y, x + extent, y + extent / 2, i);
+        }
+
+        for (int i = 0; i < 200; i++)
+        {
+            int x = random_coordinate();
+            int y = random_coordinate();
+            int extent = rand() % (1 << 19);
+
+            result.clear();
+            expected.clear();
+            integral_hash.query_at_aabb(result, x, y, x + extent, y + extent);
+
+            for (auto &b : integral_boxes)
+            {
+                if (b.left <= x + extent && x <= b.right && b.top <= y + extent && y <= b.bottom)
+                    expected.push_back(b.value);
+            }
+
+            std::sort(result.begin(), result.end());
+            if (result != expected)
+            {
+                std::cout << "\tFAIL, integral aabb query did not return exactly the overlapping values!!" << std::endl;
+                return 0;
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_frozen()
+    {
+        std::cout << "Test frozen" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::FrozenSpatialHash<Id> frozen_hash(_cell_size);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> spatial_hash(_cell_size, _test_size * 4);
+
+        for (auto &e : _test_data)
+        {
+            frozen_hash.insert_at_point(e.x, e.y, e.value, e.category % 4);
+            spatial_hash.insert_at_point(e.x, e.y, e.value, e.category % 4);
+        }
+
+        frozen_hash.build();
+
+        if (frozen_hash.size() != _test_data.size() || frozen_hash.max_probes() == 0)
+        {
+            std::cout << "\tFAIL, build lost some data!!" << std::endl;
+            return 0;
+        }
+
+        std::vector<Id> frozen_result;
+        std::vector<Id> result;
+        for (auto &e : _test_data)
+        {
+            frozen_result.clear();
+            result.clear();
+            frozen_hash.query_at_point(frozen_result, e.x, e.y, e.category % 4);
+            spatial_hash.query_at_point(result, e.x, e.y, e.category % 4);
+
+            if (frozen_result != result)
+            {
+                std::cout << "\tFAIL, frozen lookup differs!!" << std::endl;
+                return 0;
+            }
+        }
+
+        // small rectangles look up their cells, large ones scan the Morton range
+        for (real extent : {(real)3, (real)300, (real)3000000})
+        {
+            for (int query = 0; query < 20; query++)
+            {
+                auto &e = _test_data[query * 997 % _test_data.size()];
+
+                frozen_result.clear();
+                result.clear();
+                frozen_hash.query_at_aabb(frozen_result, e.x - extent, e.y - extent, e.x + extent, e.y + extent, 1);
+
+                if (extent < 100000)
+                {
+                    spatial_hash.query_at_aabb(result, e.x - extent, e.y - extent, e.x + extent, e.y + extent, 1);
+                }
+                else
+                {
+                    for (auto &o : _test_data)
+                    {
+                        if (o.category % 4 == 1)
+                            result.push_back(o.value);
+                    }
+                }
+
+                std::sort(frozen_result.begin(), frozen_result.end());
+                std::sort(result.begin(), result.end());
+
+                if (frozen_result != result)
+                {
+                    std::cout << "\tFAIL, frozen aabb query differs!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        // out of range loads are clamped, a full index would never end the probes of a missing cell
+        for (double load : {0.0, -1.0, std::nan(""), 1.0, 4.0})
+        {
+            shash::FrozenSpatialHash<Id> clamped_hash(1.0);
+            for (Id i = 0; i < 1024; i++)
+                clamped_hash.insert_at_cell((int)i, 0, i);
+
+            clamped_hash.build(load);
+
+            for (Id i = 0; i < 1024; i++)
+            {
+                result.clear();
+                clamped_hash.query_at_cell(result, (int)i, 0);
+
+                if (result.size() != 1 || result[0] != i)
+                {
+                    std::cout << "\tFAIL, clamped build lost some data!!" << std::endl;
+                    return 0;
+                }
+            }
+
+            result.clear();
+            clamped_hash.query_at_cell(result, -1, 0);
+
+            if (!result.empty())
+            {
+                std::cout << "\tFAIL, found a missing cell!!" << std::endl;
+                return 0;
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_frozen_file()
+    {
+        std::cout << "Test frozen file" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::FrozenSpatialHash<Id> frozen_hash(_cell_size * 2);
+        for (auto &e : _test_data)
+            frozen_hash.insert_at_aabb(e.x, e.y, e.x + _cell_size, e.y, e.value, e.category % 4);
+
+        frozen_hash.build();
+
+        const char *path = "frozen_test.shash";
+        if (!frozen_hash.save(path))
+        {
+            std::cout << "\tFAIL, could not save the snapshot!!" << std::endl;
+            return 0;
+        }
+
+        shash::FrozenSpatialHash<Id> loaded_hash;
+        bool loaded = loaded_hash.load(path);
+        std::remove(path);
+
+        // a buffer attached in place, and one that is not a snapshot at all
+        std::vector<uint64_t> buffer((frozen_hash.serialized_size() + 7) / 8);
+        frozen_hash.serialize(buffer.data());
+
+        shash::FrozenSpatialHash<Id> attached_hash;
+        bool attached = attached_hash.attach(buffer.data(), frozen_hash.serialized_size());
+
+        std::vector<uint64_t> garbage(64, 42);
+        bool rejected = !attached_hash.attach(garbage.data(), garbage.size() * 8) &&
+                        !shash::FrozenSpatialHash<uint64_t>().attach(buffer.data(), frozen_hash.serialized_size());
+
+        if (!loaded || !attached || !rejected || loaded_hash.cells() != frozen_hash.cells() || attached_hash.size() != frozen_hash.size())
+        {
+            std::cout << "\tFAIL, did not map the snapshot!!" << std::endl;
+            return 0;
+        }
+
+        // images with a valid header but sections, cells or slots pointing outside of them
+        using FileHeader = shash::FrozenSpatialHash<Id>::FileHeader;
+        using FrozenCell = shash::FrozenSpatialHash<Id>::Cell;
+
+        auto corrupted = [&buffer, &frozen_hash](auto &&corrupt) {
+            std::vector<uint64_t> copy = buffer;
+            FileHeader header;
+            std::memcpy(&header, copy.data(), sizeof(header));
+            corrupt(header, reinterpret_cast<char *>(copy.data()));
+            std::memcpy(copy.data(), &header, sizeof(header));
+            return !shash::FrozenSpatialHash<Id>().attach(copy.data(), frozen_hash.serialized_size());
+        };
+
+        bool checked = corrupted([](FileHeader &header, char *) { header.cell_size = 0; }) &&
+                       corrupted([](FileHeader &header, char *) { header.cell_size = -1; }) &&
+                       corrupted([](FileHeader &header, char *) { header.cell_size = std::numeric_limits<double>::infinity(); }) &&
+                       corrupted([](FileHeader &header, char *) { header.cell_size = std::numeric_limits<double>::quiet_NaN(); }) &&
+                       corrupted([](FileHeader &header, char *) { header.index_size = 0; }) &&
+                       corrupted([](FileHeader &header, char *) { header.max_probes = header.index_size + 1; }) &&
+                       corrupted([](FileHeader &header, char *) { header.cells_offset = UINT64_MAX - 63; }) &&
+                       corrupted([](FileHeader &header, char *) { header.value_count = UINT64_MAX / 2; }) &&
+                       corrupted([](FileHeader &header, char *bytes) {
+                           FrozenCell *cells = reinterpret_cast<FrozenCell *>(bytes + header.cells_offset);
+                           cells[0].last = header.value_count + 1;
+                       }) &&
+                       corrupted([](FileHeader &header, char *bytes) {
+                           FrozenCell *cells = reinterpret_cast<FrozenCell *>(bytes + header.cells_offset);
+                           cells[0].first = cells[0].last + 1;
+                       }) &&
+                       corrupted([](FileHeader &header, char *bytes) {
+                           uint32_t *index = reinterpret_cast<uint32_t *>(bytes + header.index_offset);
+                           *std::find_if(index, index + header.index_size, [](uint32_t slot) { return slot != (uint32_t)-1; }) = (uint32_t)header.cell_count;
+                       });
+
+        if (!checked)
+        {
+            std::cout << "\tFAIL, attached a corrupted snapshot!!" << std::endl;
+            return 0;
+        }
+
+        // over-aligned values need their alignment at the start of the data, not just the one of the header
+        struct alignas(16) Wide
+        {
+            Id value;
+        };
+
+        shash::FrozenSpatialHash<Wide> wide_hash(_cell_size);
+        wide_hash.insert_at_point(0, 0, Wide{1});
+        wide_hash.build();
+
+        std::vector<uint64_t> wide_buffer((wide_hash.serialized_size() + 15) / 8 + 1);
+        char *wide_data = reinterpret_cast<char *>(wide_buffer.data());
+        wide_data += (16 - (uintptr_t)wide_data % 16) % 16;
+
+        wide_hash.serialize(wide_data);
+        bool wide_attached = shash::FrozenSpatialHash<Wide>().attach(wide_data, wide_hash.serialized_size());
+
+        std::memmove(wide_data + 8, wide_data, wide_hash.serialized_size());
+        bool wide_misaligned = shash::FrozenSpatialHash<Wide>().attach(wide_data + 8, wide_hash.serialized_size());
+
+        if (!wide_attached || wide_misaligned)
+        {
+            std::cout << "\tFAIL, attached a misaligned snapshot!!" << std::endl;
+            return 0;
+        }
+
+        shash::FrozenSpatialHash<Id> moved_hash = std::move(loaded_hash);
+
+        std::vector<Id> expected;
+        std::vector<Id> result;
+        for (auto &e : _test_data)
+        {
+            expected.clear();
+            frozen_hash.query_at_aabb(expected, e.x - 5, e.y - 5, e.x + 5, e.y + 5, e.category % 4);
+
+            for (auto *hash : {&moved_hash, &attached_hash})
+            {
+                result.clear();
+                hash->query_at_aabb(result, e.x - 5, e.y - 5, e.x + 5, e.y + 5, e.category % 4);
+
+                if (result != expected || std::find(result.begin(), result.end(), e.value) == result.end())
+                {
+                    std::cout << "\tFAIL, mapped snapshot differs!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_buffered()
+    {
+        std::cout << "Test buffered" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        using Hash = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5>;
+        shash::BufferedSpatialHash<Hash, 3> buffered_hash(_cell_size, 4096);
+
+        // every frame stores its number at the same 1000 points, a consistent view only ever holds one number
+        auto build = [&](Id frame) {
+            Hash &hash = buffered_hash.begin_build(_cell_size, 4096);
+            for (int i = 0; i < 1000; i++)
+                hash.insert_at_point(_test_data[i].x, _test_data[i].y, frame);
+            buffered_hash.publish();
+        };
+
+        build(1);
+        {
+            auto view = buffered_hash.read();
+            build(2);
+            build(3);
+
+            std::vector<Id> result;
+            view->query_at_point(result, _test_data[0].x, _test_data[0].y);
+            if (view.frame() != 1 || result.size() != 1 || result[0] != 1 || buffered_hash.read().frame() != 3)
+            {
+                std::cout << "\tFAIL, a pinned view changed!!" << std::endl;
+                return 0;
+            }
+        }
+
+        std::atomic<bool> done{false};
+        std::vector<int> results(3, 1);
+        std::vector<std::thread> readers;
+
+        for (size_t t = 0; t < results.size(); t++)
+        {
+            readers.emplace_back([&, t]() {
+                size_t last_frame = 0;
+                std::vector<Id> result;
+
+                while (!done.load())
+                {
+                    auto view = buffered_hash.read();
+                    if (view.frame() < last_frame)
+                        results[t] = 0;
+                    last_frame = view.frame();
+
+                    for (int i = 0; i < 1000; i += 7)
+                    {
+                        result.clear();
+                        view->query_at_point(result, _test_data[i].x, _test_data[i].y);
+
+                        for (Id value : result)
+                        {
+                            if (value != view.frame())
+                                results[t] = 0;
+                        }
+                    }
+                }
+            });
+        }
+
+        for (Id frame = 4; frame < 200; frame++)
+            build(frame);
+
+        done = true;
+        for (auto &reader : readers)
+            reader.join();
+
+        if (std::find(results.begin(), results.end(), 0) != results.end())
+        {
+            std::cout << "\tFAIL, a reader saw a torn frame!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_concurrent_query()
+    {
+        std::cout << "Test concurrent query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5> spatial_hash(_cell_size, _test_size * 2);
+
+        for (auto &e : _test_data)
+        {
+            spatial_hash.insert_at_point(e.x, e.y, e.value, e.category);
+        }
+
+        const auto &shared_hash = spatial_hash;
+        std::vector<int> results(4, 1);
+        std::vector<std::thread> threads;
+
+        for (size_t t = 0; t < results.size(); t++)
+        {
+            threads.emplace_back([this, &shared_hash, &results, t]() {
+                std::vector<Id> result;
+                for (size_t i = t; i < _test_data.size(); i += results.size())
+                {
+                    auto &e = _test_data[i];
+                    result.clear();
+                    shared_hash.query_at_point(result, e.x, e.y, e.category);
+
+                    if (std::find(result.begin(), result.end(), e.value) == result.end())
+                        results[t] = 0;
+
+                    shared_hash.query_at_point(result, e.x + _cell_size * 0.5, e.y - _cell_size * 3, e.category);
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        if (std::find(results.begin(), results.end(), 0) != results.end())
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_concurrent_insert()
+    {
+        std::cout << "Test concurrent insert" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::ConcurrentSpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 16, 8> spatial_hash(_cell_size, _test_size * 2);
+        const size_t thread_count = 4;
+        std::vector<std::thread> threads;
+
+        for (size_t t = 0; t < thread_count; t++)
+        {
+            threads.emplace_back([this, &spatial_hash, t]() {
+                for (size_t i = t; i < _test_data.size(); i += thread_count)
+                {
+                    auto &e = _test_data[i];
+                    spatial_hash.insert_at_point(e.x, e.y, e.value, e.category);
+                }
+
+                // many threads hammering the same cell spill far beyond the slots of its bucket
+                for (Id i = 0; i < 2000; i++)
+                {
+                    spatial_hash.insert_at_point(0.5, 0.5, i, 1);
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        std::vector<Id> result;
+        for (auto &e : _test_data)
+        {
+            result.clear();
+            spatial_hash.query_at_point(result, e.x, e.y, e.category);
+
+            if (std::find(result.begin(), result.end(), e.value) == result.end())
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        result.clear();
+        spatial_hash.query_at_point(result, 0.5, 0.5, 1);
+        std::sort(result.begin(), result.end());
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            if (result.size() != 2000 * thread_count || result[i] != i / thread_count)
+            {
+                std::cout << "\tFAIL, lost some data of a spilled bucket!!" << std::endl;
+                return 0;
+            }
+        }
+
+        // far more cells than buckets, the cells whose probes are all taken live in the stash
+        shash::ConcurrentSpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 2, 8> small_hash(_cell_size, 64);
+        threads.clear();
+
+        for (size_t t = 0; t < thread_count; t++)
+        {
+            threads.emplace_back([this, &small_hash, t]() {
+                for (size_t i = t; i < 4096; i += thread_count)
+                {
+                    auto &e = _test_data[i];
+                    small_hash.insert_at_point(e.x, e.y, e.value, e.category);
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        if (small_hash.overflows() == 0)
+        {
+            std::cout << "\tFAIL, overfull table did not overflow!!" << std::endl;
+            return 0;
+        }
+
+        for (size_t i = 0; i < 4096; i++)
+        {
+            auto &e = _test_data[i];
+            result.clear();
+            small_hash.query_at_point(result, e.x, e.y, e.category);
+
+            if (std::find(result.begin(), result.end(), e.value) == result.end())
+            {
+                std::cout << "\tFAIL, lost some data of an overfull table!!" << std::endl;
+                return 0;
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    template <typename SpatialHash>
+    int test_remove_move(SpatialHash &spatial_hash)
+    {
+        Id val1 = 1;
+        Id val2 = 2;
+
+        spatial_hash.insert_at_aabb(0.0, 0.0, 20.0, 20.0, val1, 1);
+        spatial_hash.insert_at_aabb(10.0, 10.0, 30.0, 30.0, val2, 1);
+        for (Id i = 10; i < 30; i++)
+            spatial_hash.insert_at_point(20.5, 20.5, i, 1);
+
+        std::vector<Id> result;
+
+        // staying inside the same cells does not change anything
+        spatial_hash.move_at_aabb(0.0, 0.0, 20.0, 20.0, 0.2, 0.3, 20.9, 20.9, val1, 1);
+        spatial_hash.query_at_aabb(result, 0.0, 0.0, 30.0, 30.0, 1);
+        if (result.size() != 441 + 441 + 20)
+        {
+            std::cout << "\tFAIL, move changed the data!!" << std::endl;
+            return 0;
+        }
+
+        spatial_hash.move_at_aabb(0.0, 0.0, 20.0, 20.0, 5.0, 5.0, 25.0, 25.0, val1, 1);
+        result.clear();
+        spatial_hash.query_at_aabb(result, 0.0, 0.0, 4.0, 4.0, 1);
+        if (!result.empty())
+        {
+            std::cout << "\tFAIL, move left some data behind!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_point(result, 25.0, 25.0, 1);
+        if (result.size() != 2)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_aabb(result, 0.0, 0.0, 30.0, 30.0, 1);
+        if (result.size() != 441 + 441 + 20)
+        {
+            std::cout << "\tFAIL, move lost some data!!" << std::endl;
+            return 0;
+        }
+
+        for (Id i = 10; i < 30; i += 2)
+        {
+            if (!spatial_hash.remove_at_point(20.5, 20.5, i, 1))
+            {
+                std::cout << "\tFAIL, did not remove some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        spatial_hash.move_at_point(20.5, 20.5, 40.5, 40.5, val2, 1);
+        if (spatial_hash.remove_at_point(20.5, 20.5, 10, 1) || !spatial_hash.remove_at_point(40.5, 40.5, val2, 1))
+        {
+            std::cout << "\tFAIL, removed the wrong data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_point(result, 20.5, 20.5, 1);
+        std::sort(result.begin(), result.end());
+        if (result != std::vector<Id>{1, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29})
+        {
+            std::cout << "\tFAIL, removed the wrong data!!" << std::endl;
+            return 0;
+        }
+
+        if (!spatial_hash.remove_at_aabb(5.0, 5.0, 25.0, 25.0, val1, 1) || spatial_hash.remove_at_aabb(5.0, 5.0, 25.0, 25.0, val1, 1))
+        {
+            std::cout << "\tFAIL, did not remove some data!!" << std::endl;
+            return 0;
+        }
+
+        // a wrong old position moves nothing, val2 already left the cell at (20, 20)
+        bool moved = spatial_hash.move_at_point(50.5, 50.5, 60.5, 60.5, val1, 1) ||
+                     spatial_hash.move_at_aabb(10.0, 10.0, 30.0, 30.0, 100.0, 100.0, 120.0, 120.0, val2, 1);
+
+        result.clear();
+        spatial_hash.query_at_aabb(result, 0.0, 0.0, 120.0, 120.0, 1);
+        if (moved || std::count(result.begin(), result.end(), val1) != 0 || std::count(result.begin(), result.end(), val2) != 440)
+        {
+            std::cout << "\tFAIL, moved from a wrong old position!!" << std::endl;
+            return 0;
+        }
+
+        return 1;
+    }
+
+    int test_remove_move()
+    {
+        std::cout << "Test remove / move" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> vector_hash(1.0, 10000);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Arena<4>> arena_hash(1.0, 10000);
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Inline<2, 2>> inline_hash(1.0, 10000);
+
+        if (!test_remove_move(vector_hash) || !test_remove_move(arena_hash) || !test_remove_move(inline_hash))
+            return 0;
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_overflow()
+    {
+        std::cout << "Test overflow" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        // far more cells than buckets, most cells end up in the overflow stash
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 1> spatial_hash(1.0, 64);
+
+        for (Id i = 0; i < 1000; i++)
+        {
+            spatial_hash.insert_at_point(i, 0.0, i, 0);
+            spatial_hash.insert_at_point(i, 0.0, i, 1);
+        }
+
+        if (spatial_hash.overflows() == 0 || spatial_hash.overflow_cells() != spatial_hash.overflows())
+        {
+            std::cout << "\tFAIL, did not count overflows!!" << std::endl;
+            return 0;
+        }
+
+        std::vector<Id> result;
+        for (Id i = 0; i < 1000; i++)
+        {
+            for (int salt : {0, 1})
+            {
+                result.clear();
+                spatial_hash.query_at_point(result, i, 0.0, salt);
+                if (result.size() != 1 || result[0] != i)
+                {
+                    std::cout << "\tFAIL, cells got mixed up!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        spatial_hash.reset(1.0, 64);
+        if (spatial_hash.overflows() != 0 || spatial_hash.overflow_cells() != 0)
+        {
+            std::cout << "\tFAIL, did not reset overflows!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_load_factor()
+    {
+        std::cout << "Test load factor" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 1> spatial_hash(1.0, 64);
+        spatial_hash.set_load_factor(0.5, 0.1);
+
+        for (int round = 0; round < 4; round++)
+        {
+            for (Id i = 0; i < 1000; i++)
+                spatial_hash.insert_at_point(i, 0.0, i);
+
+            spatial_hash.reset(1.0, 64);
+        }
+
+        if (spatial_hash.table_size() < 2000)
+        {
+            std::cout << "\tFAIL, table did not grow!!" << std::endl;
+            return 0;
+        }
+
+        for (Id i = 0; i < 1000; i++)
+            spatial_hash.insert_at_point(i, 0.0, i);
+
+        if (spatial_hash.claimed_buckets() + spatial_hash.overflow_cells() != 1000 || spatial_hash.mean_probe_length() < 1.0)
+        {
+            std::cout << "\tFAIL, did not count claimed buckets!!" << std::endl;
+            return 0;
+        }
+
+        // a few quiet rounds shrink the table back to the requested size
+        for (int round = 0; round < 16; round++)
+            spatial_hash.reset(1.0, 64);
+
+        if (spatial_hash.table_size() != 64)
+        {
+            std::cout << "\tFAIL, table did not shrink!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_radius_query()
+    {
+        std::cout << "Test radius query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> spatial_hash(1.0, 10000);
+
+        // one value in the middle of every cell, the id encodes the cell
+        std::vector<Id> ids;
+        for (int x = -10; x <= 10; x++)
+        {
+            for (int y = -10; y <= 10; y++)
+                ids.push_back((x + 10) * 21 + (y + 10));
+        }
+        auto cell_x = [](Id id) { return (int)(id / 21) - 10; };
+        auto cell_y = [](Id id) { return (int)(id % 21) - 10; };
+        for (Id &id : ids)
+            spatial_hash.insert_at_point(cell_x(id) + 0.5, cell_y(id) + 0.5, id);
+
+        double center_x = 0.3;
+        double center_y = 0.6;
+        double radius = 3.2;
+
+        size_t expected = 0;
+        for (Id id : ids)
+        {
+            double dx = std::max(std::max(cell_x(id) - center_x, center_x - (cell_x(id) + 1)), 0.0);
+            double dy = std::max(std::max(cell_y(id) - center_y, center_y - (cell_y(id) + 1)), 0.0);
+            if (dx * dx + dy * dy <= radius * radius)
+                expected++;
+        }
+
+        std::vector<Id> result;
+        spatial_hash.query_at_radius(result, center_x, center_y, radius);
+        if (result.size() != expected)
+        {
+            std::cout << "\tFAIL, did not find the cells of the disc!!" << std::endl;
+            return 0;
+        }
+
+        std::vector<Id> square;
+        spatial_hash.query_at_aabb(square, center_x - radius, center_y - radius, center_x + radius, center_y + radius);
+        if (result.size() >= square.size())
+        {
+            std::cout << "\tFAIL, did not cull the corners!!" << std::endl;
+            return 0;
+        }
+
+        int last_ring = 0;
+        size_t visited = 0;
+        bool ordered = true;
+        spatial_hash.for_each_at_radius_outward(
+            [&](const Id &id) {
+                int ring = std::max(std::abs(cell_x(id)), std::abs(cell_y(id)));
+                ordered &= ring >= last_ring;
+                last_ring = ring;
+                visited++;
+            },
+            center_x, center_y, radius);
+
+        if (!ordered || visited != expected)
+        {
+            std::cout << "\tFAIL, outward walk is out of order!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_knn_query()
+    {
+        std::cout << "Test knn query" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        using Hash = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10>;
+        Hash spatial_hash(2.0, 10000);
+
+        std::vector<Hash::Key> positions;
+        for (Id i = 0; i < 1000; i++)
+        {
+            positions.push_back({(i * 7919 % 1000) * 0.05, (i * 104729 % 997) * 0.05});
+            spatial_hash.insert_at_point(positions[i].x, positions[i].y, i);
+        }
+
+        // a wide value living in several cells is still reported once
+        Id wide = 1000;
+        positions.push_back({25.0, 25.0});
+        spatial_hash.insert_at_aabb(23.0, 23.0, 27.0, 27.0, wide);
+
+        auto position = [&positions](const Id &id) { return positions[id]; };
+
+        std::vector<Hash::Neighbour> result;
+        // far away queries start at the first ring reaching the data instead of walking up to it
+        for (double x : {-3.0, 0.1, 25.0, 31.7, 60.0, 1.0e7})
+        {
+            for (size_t k : {1, 8, 2000})
+            {
+                double y = 50.0 - x;
+                spatial_hash.query_knn(result, x, y, k, position);
+
+                std::vector<double> expected;
+                for (const Hash::Key &p : positions)
+                    expected.push_back((p.x - x) * (p.x - x) + (p.y - y) * (p.y - y));
+                std::sort(expected.begin(), expected.end());
+                expected.resize(std::min(k, expected.size()));
+
+                if (result.size() != expected.size())
+                {
+                    std::cout << "\tFAIL, did not find k neighbours!!" << std::endl;
+                    return 0;
+                }
+
+                for (size_t i = 0; i < result.size(); i++)
+                {
+                    if (result[i].distance_squared != expected[i])
+                    {
+                        std::cout << "\tFAIL, did not find the nearest neighbours!!" << std::endl;
+                        return 0;
+                    }
+                }
+            }
+        }
+
+        spatial_hash.reset(2.0, 10000);
+        spatial_hash.query_knn(result, 0.0, 0.0, 8, position);
+        if (!result.empty())
+        {
+            std::cout << "\tFAIL, found neighbours in an empty hash!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    template <typename Storage>
+    int test_potential_pairs()
+    {
+        std::cout << "Test potential pairs" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        using Hash = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, Storage>;
+        Hash spatial_hash(1.0, 10000);
+
+        std::vector<typename Hash::Bounds> bounds;
+        for (Id i = 0; i < 500; i++)
+        {
+            double x = (i * 7919 % 1000) * 0.04;
+            double y = (i * 104729 % 997) * 0.04;
+            double size = (i % 5) * 0.7;
+            bounds.push_back({x, y, x + size, y + size});
+            spatial_hash.insert_at_aabb(x, y, x + size, y + size, i);
+        }
+
+        auto bounds_fn = [&bounds](const Id &id) { return bounds[id]; };
+
+        // every two values whose cell ranges overlap, exactly once
+        std::vector<std::pair<Id, Id>> expected;
+        for (Id a = 0; a < bounds.size(); a++)
+        {
+            for (Id b = a + 1; b < bounds.size(); b++)
+            {
+                if (spatial_hash.cell(bounds[a].top_left_x) <= spatial_hash.cell(bounds[b].bottom_right_x) &&
+                    spatial_hash.cell(bounds[b].top_left_x) <= spatial_hash.cell(bounds[a].bottom_right_x) &&
+                    spatial_hash.cell(bounds[a].top_left_y) <= spatial_hash.cell(bounds[b].bottom_right_y) &&
+                    spatial_hash.cell(bounds[b].top_left_y) <= spatial_hash.cell(bounds[a].bottom_right_y))
+                    expected.push_back({a, b});
+            }
+        }
+
+        auto normalized = [](std::vector<std::pair<Id, Id>> pairs) {
+            for (auto &pair : pairs)
+            {
+                if (pair.first > pair.second)
+                    std::swap(pair.first, pair.second);
+            }
+            std::sort(pairs.begin(), pairs.end());
+            return pairs;
+        };
+
+        std::vector<std::pair<Id, Id>> pairs;
+        spatial_hash.for_each_potential_pair([&pairs](const Id &a, const Id &b) { pairs.push_back({a, b}); }, bounds_fn);
+
+        if (normalized(pairs) != expected)
+        {
+            std::cout << "\tFAIL, did not find every pair exactly once!!" << std::endl;
+            return 0;
+        }
+
+        for (unsigned int threads : {1, 4})
+        {
+            std::vector<std::vector<std::pair<Id, Id>>> per_thread;
+            spatial_hash.query_potential_pairs(per_thread, bounds_fn, threads);
+
+            pairs.clear();
+            for (auto &thread_pairs : per_thread)
+                pairs.insert(pairs.end(), thread_pairs.begin(), thread_pairs.end());
+
+            if (per_thread.size() != threads || normalized(pairs) != expected)
+            {
+                std::cout << "\tFAIL, threads did not find every pair exactly once!!" << std::endl;
+                return 0;
+            }
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    // counts what goes through to the upstream resource
+    class CountingResource : public std::pmr::memory_resource
+    {
+    public:
+        size_t allocations = 0;
+        size_t bytes = 0;
+
+    private:
+        void *do_allocate(size_t size, size_t alignment) override
+        {
+            allocations++;
+            bytes += size;
+            return std::pmr::new_delete_resource()->allocate(size, alignment);
+        }
+
+        void do_deallocate(void *pointer, size_t size, size_t alignment) override
+        {
+            bytes -= size;
+            std::pmr::new_delete_resource()->deallocate(pointer, size, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // an unsynchronized pool that counts the allocations made from any other thread than the one that created it
+    class OwnerThreadResource : public std::pmr::memory_resource
+    {
+    public:
+        std::atomic<size_t> foreign_allocations{0};
+
+    private:
+        void *do_allocate(size_t size, size_t alignment) override
+        {
+            if (std::this_thread::get_id() != _owner)
+                foreign_allocations++;
+            return _pool.allocate(size, alignment);
+        }
+
+        void do_deallocate(void *pointer, size_t size, size_t alignment) override
+        {
+            _pool.deallocate(pointer, size, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+
+        std::thread::id _owner = std::this_thread::get_id();
+        std::pmr::unsynchronized_pool_resource _pool;
+    };
+
+    template <typename Storage>
+    int test_memory_resource()
+    {
+        std::cout << "Test memory resource" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        CountingResource resource;
+
+        {
+            shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, Storage> spatial_hash(1.0, 10000, &resource);
+
+            size_t allocations = 0;
+            for (int round = 0; round < 3; round++)
+            {
+                spatial_hash.reset(1.0, 10000);
+
+                for (Id i = 0; i < 1000; i++)
+                    spatial_hash.insert_at_point(i % 100, i / 100, i);
+
+                if (round == 1)
+                    allocations = resource.allocations;
+            }
+
+            // the round arena hands the blocks of the first round out again, vector buckets keep their own capacity
+            bool reused = !std::is_same<Storage, shash::storage::Monotonic>::value || resource.allocations == allocations;
+
+            if (!reused || resource.bytes == 0)
+            {
+                std::cout << "\tFAIL, did not allocate from the resource!!" << std::endl;
+                return 0;
+            }
+
+            std::vector<Id> result;
+            for (Id i = 0; i < 1000; i++)
+            {
+                result.clear();
+                spatial_hash.query_at_point(result, i % 100, i / 100);
+                if (result.size() != 1 || result[0] != i)
+                {
+                    std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                    return 0;
+                }
+            }
+        }
+
+        if (resource.bytes != 0)
+        {
+            std::cout << "\tFAIL, leaked memory!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_trim()
+    {
+        std::cout << "Test trim" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10> spatial_hash(1.0, 1000);
+
+        // a spike round grows every bucket, the following rounds only touch a few cells
+        spatial_hash.reset(1.0, 1000);
+        for (Id i = 0; i < 20000; i++)
+            spatial_hash.insert_at_point(i % 20, (i / 20) % 20, i);
+
+        size_t spike = spatial_hash.bucket_bytes();
+
+        spatial_hash.reset(1.0, 1000);
+        for (Id i = 0; i < 10; i++)
+            spatial_hash.insert_at_point(i, 0, i);
+
+        size_t freed = spatial_hash.trim(0);
+        if (spike == 0 || freed == 0 || spatial_hash.bucket_bytes() * 10 > spike)
+        {
+            std::cout << "\tFAIL, did not free stale buckets!!" << std::endl;
+            return 0;
+        }
+
+        std::vector<Id> result;
+        for (Id i = 0; i < 10; i++)
+        {
+            result.clear();
+            spatial_hash.query_at_point(result, i, 0);
+            if (result.size() != 1 || result[0] != i)
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        // the amortized trim gives the spike back once its buckets aged out
+        spatial_hash.reset(1.0, 1000);
+        for (Id i = 0; i < 20000; i++)
+            spatial_hash.insert_at_point(i % 20, (i / 20) % 20, i);
+
+        spatial_hash.set_trim(2, spatial_hash.table_size());
+        for (int round = 0; round < 3; round++)
+            spatial_hash.reset(1.0, 1000);
+
+        if (spatial_hash.bucket_bytes() != 0)
+        {
+            std::cout << "\tFAIL, kept memory of stale buckets!!" << std::endl;
+            return 0;
+        }
+
+        Id value = 1;
+        spatial_hash.insert_at_point(0.5, 0.5, value);
+        spatial_hash.shrink_to_fit();
+
+        result.clear();
+        spatial_hash.query_at_point(result, 0.5, 0.5);
+        if (result.size() != 1 || result[0] != 1)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
+    int test_stats()
+    {
+        std::cout << "Test stats" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 5, shash::storage::Vector, shash::coordinates::Scaled<>, shash::statistics::Probes> spatial_hash(_cell_size, _test_size);
+        shash::SpatialHash<Id> plain_hash(_cell_size, _test_size);
+
+        for (int round = 0; round < 2; round++)
+        {
+            spatial_hash.reset(_cell_size, _test_size);
+            plain_hash.reset(_cell_size, _test_size);
+
+            for (auto &e : _test_data)
+            {
+                spatial_hash.insert_at_point(e.x, e.y, e.value, e.category);
+                plain_hash.insert_at_point(e.x, e.y, e.value, e.category);
+            }
+        }
+
+        auto stats = spatial_hash.stats();
+        size_t probed = std::accumulate(stats.probe_lengths.begin(), stats.probe_lengths.end(), (size_t)0);
+        size_t buckets = std::accumulate(stats.bucket_sizes.begin(), stats.bucket_sizes.end(), (size_t)0);
+
+        // every one of the 6 rounds walks a group of 4 headers
+        if (stats.values != _test_data.size() || probed + stats.exhausted_probes != _test_data.size() ||
+            buckets != stats.claimed_buckets + stats.overflow_cells || stats.probe_lengths.size() != 24 ||
+            stats.probe_lengths[0] < stats.probe_lengths[23])
+        {
+            std::cout << "\tFAIL, stats do not add up!!" << std::endl;
+            return 0;
+        }
+
+        auto plain = plain_hash.stats();
+        if (!plain.probe_lengths.empty() || plain.values != stats.values || plain.claimed_buckets != stats.claimed_buckets)
+        {
+            std::cout << "\tFAIL, disabled stats recorded probes!!" << std::endl;
+            return 0;
+        }
+
+        std::cout
+            << "\tClaimed: " << stats.claimed_buckets
+            << " \tMean probes: " << stats.mean_probe_length
+            << " \tExhausted: " << stats.exhausted_probes
+            << " \tBucket bytes: " << stats.bucket_bytes
+            << std::endl;
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
     int test_insert_query_segment()
     {
         std::cout << "Test insert query segment" << std::endl;
@@ -76,7 +2091,85 @@ public:
         spatial_hash.insert_at_segment(0.0, 0.0, 20.0, 20.0, val1, 1);
         spatial_hash.insert_at_segment(10.0, 0.0, 0.0, 30.0, val2, 1);
 
-        // TODO
+        std::vector<Id> result;
+        spatial_hash.query_at_point(result, 7.5, 7.5, 1);
+        if (result.size() != 2)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        // an exact diagonal only passes through the diagonal cells
+        result.clear();
+        spatial_hash.query_at_point(result, 1.5, 0.5, 1);
+        if (result.size() != 0)
+        {
+            std::cout << "\tFAIL, found data where there should not be one!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        spatial_hash.query_at_segment(result, 0.0, 0.0, 20.0, 20.0, 1);
+        if (std::count(result.begin(), result.end(), val1) < 20)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        // every cell the segment crosses, also the ones bresenham would cut
+        spatial_hash.insert_at_segment(0.5, 0.5, 3.5, 2.5, val1, 2);
+        std::vector<std::pair<int, int>> crossed = {{0, 0}, {1, 0}, {1, 1}, {2, 1}, {2, 2}, {3, 2}};
+        for (auto &c : crossed)
+        {
+            result.clear();
+            spatial_hash.query_at_cell(result, c.first, c.second, 2);
+            if (result.size() != 1)
+            {
+                std::cout << "\tFAIL, did not find some data!!" << std::endl;
+                return 0;
+            }
+        }
+
+        result.clear();
+        spatial_hash.query_at_aabb(result, 0.0, 0.0, 4.0, 4.0, 2);
+        if (result.size() != crossed.size())
+        {
+            std::cout << "\tFAIL, segment touched too many cells!!" << std::endl;
+            return 0;
+        }
+
+        // the ray stops at the first blocker and never looks at the cells behind it
+        Id blocker1 = 10;
+        Id blocker2 = 20;
+        spatial_hash.insert_at_point(5.5, 0.5, blocker1, 3);
+        spatial_hash.insert_at_point(8.5, 0.5, blocker2, 3);
+
+        std::vector<Id> hits;
+        double hit_t = 0.0;
+        bool through = spatial_hash.raycast(
+            [&](const Id &value, double t_enter, double) {
+                hits.push_back(value);
+                hit_t = t_enter;
+                return false;
+            },
+            0.5, 0.5, 1.0, 0.0, 100.0, 3);
+
+        if (through || hits.size() != 1 || hits[0] != blocker1 || hit_t != 4.5)
+        {
+            std::cout << "\tFAIL, raycast did not stop at the first hit!!" << std::endl;
+            return 0;
+        }
+
+        hits.clear();
+        through = spatial_hash.raycast(
+            [&](const Id &value, double, double) { hits.push_back(value); },
+            9.5, 0.5, -1.0, 0.0, 2.0, 3);
+
+        if (!through || hits.size() != 1 || hits[0] != blocker2)
+        {
+            std::cout << "\tFAIL, raycast did not respect max_t!!" << std::endl;
+            return 0;
+        }
 
         auto t2 = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
@@ -138,6 +2231,87 @@ public:
         return 1;
     }
 
+    int test_coordinates()
+    {
+        std::cout << "Test coordinates" << std::endl;
+
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        // 16.16 fixed-point coordinates with a cell size of 1.0
+        using Fixed = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Vector,
+                                         shash::coordinates::Scaled<int32_t>>;
+        using Shifted = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Vector,
+                                           shash::coordinates::PowerOfTwo<16>>;
+        using Single = shash::SpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, shash::storage::Vector,
+                                          shash::coordinates::Scaled<float>>;
+        using Concurrent = shash::ConcurrentSpatialHash<Id, shash::hashing::Murmur, shash::reduction::FastRange, 10, 8,
+                                                        shash::coordinates::Scaled<int32_t>>;
+
+        shash::SpatialHash<Id> reference(1.0, 1000);
+        Fixed fixed(1 << 16, 1000);
+        Shifted shifted(0, 1000);
+        Single single(1.0f, 1000);
+        Concurrent concurrent(1 << 16, 1000);
+
+        for (int32_t coordinate : {0, 1, 65535, 65536, 65537, -1, -65535, -65536, -65537, 2000000000, -2000000000})
+        {
+            int expected = reference.cell(coordinate / 65536.0);
+            if (fixed.cell(coordinate) != expected || shifted.cell(coordinate) != expected ||
+                single.cell(coordinate / 65536.0f) != expected || concurrent.cell(coordinate) != expected)
+            {
+                std::cout << "\tFAIL, wrong cell for " << coordinate << "!!" << std::endl;
+                return 0;
+            }
+        }
+
+        const int32_t one = 1 << 16;
+        Id val1 = 1;
+        Id val2 = 2;
+        shifted.insert_at_point(3 * one, -5 * one, val1);
+        shifted.insert_at_aabb(-2 * one, -2 * one, 2 * one, 2 * one, val2);
+
+        std::vector<Id> result;
+        shifted.query_at_point(result, 3 * one + 100, -5 * one + 100);
+        if (result.size() != 1 || result[0] != val1)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        shifted.query_at_radius(result, 0, 0, one + one / 2);
+        if (result.size() != 16)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        result.clear();
+        shifted.query_at_segment(result, -10 * one, one / 2, 10 * one, one / 2);
+        if (result.size() != 5)
+        {
+            std::cout << "\tFAIL, did not find some data!!" << std::endl;
+            return 0;
+        }
+
+        concurrent.insert_at_segment(-2 * one, one / 2, 2 * one - 1, one / 2, val1);
+        concurrent.insert_at_point(-one - one / 2, -one / 2, val2);
+
+        result.clear();
+        concurrent.query_at_aabb(result, -2 * one, -one, 2 * one - 1, one - 1);
+        if (std::count(result.begin(), result.end(), val1) != 4 || std::count(result.begin(), result.end(), val2) != 1)
+        {
+            std::cout << "\tFAIL, concurrent hash missed fixed-point cells!!" << std::endl;
+            return 0;
+        }
+
+        auto t2 = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        std::cout << "\tDuration: " << duration << " milliseconds " << std::endl;
+
+        return 1;
+    }
+
     int test_insert_query_point()
     {
         std::cout << "Test insert query point" << std::endl;
@@ -174,6 +2348,7 @@ public:
             std::cout
                 << "\tLoad: " << load
                 << " \tCollisions: " << (real)collisions / _test_size
+                << " \tOverflows: " << (real)spatial_hash.overflow_cells() / _test_size
                 << std::endl;
         }
 
@@ -184,6 +2359,49 @@ public:
         return 1;
     }
 
+    template <typename HashFunction>
+    int test_hash_row()
+    {
+        shash::HashValue hashes[37];
+
+        for (int round = 0; round < 100; round++)
+        {
+            uint32_t key[4] = {(uint32_t)std::rand() - RAND_MAX / 2, (uint32_t)std::rand() - RAND_MAX / 2, (uint32_t)(std::rand() % 256), (uint32_t)round};
+            size_t count = round % 37 + 1;
+
+            HashFunction::hash_row(key[0], key[1], key[2], key[3], hashes, count);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t buf[4] = {key[0] + (uint32_t)i, key[1], key[2], key[3]};
+                if (hashes[i] != HashFunction::hash((void *)buf) || hashes[i] != HashFunction::hash(buf[0], buf[1], buf[2], buf[3]))
+                    return 0;
+            }
+        }
+
+        // the typed key hash is usable at compile time
+        constexpr shash::HashValue hash = HashFunction::hash(1, 2, 3, 4);
+        uint32_t buf[4] = {1, 2, 3, 4};
+
+        return hash == HashFunction::hash((void *)buf);
+    }
+
+    int test_hash_row()
+    {
+        std::cout << "Test hash_row" << std::endl;
+
+        if (!test_hash_row<shash::hashing::Murmur>() ||
+            !test_hash_row<shash::hashing::xxHash>() ||
+            !test_hash_row<shash::hashing::Custom>() ||
+            !test_hash_row<shash::hashing::Knuth>())
+        {
+            std::cout << "\tFAIL, batched and single hashes differ!!" << std::endl;
+            return 0;
+        }
+
+        return 1;
+    }
+
     int test_get_cell()
     {
         std::cout << "Test get_cell / hash collisions" << std::endl;
@@ -210,7 +2428,7 @@ public:
                 int cell_y = spatial_hash.cell(e.y);
                 auto bucket = spatial_hash.get_bucket(cell_x, cell_y, e.category);
 
-                if (bucket->x != cell_x || bucket->y != cell_y)
+                if (spatial_hash.find_bucket(cell_x, cell_y, e.category) != bucket)
                     collisions++;
 
                 if (std::find(bucket->data.begin(), bucket->data.end(), e.value) == bucket->data.end())
@@ -223,6 +2441,7 @@ public:
             std::cout
                 << "\tLoad: " << load
                 << " \tCollisions: " << (real)collisions / _test_size
+                << " \tOverflows: " << (real)spatial_hash.overflow_cells() / _test_size
                 << std::endl;
         }
 